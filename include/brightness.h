@@ -1,5 +1,7 @@
 #pragma once
 
+#include <stdbool.h>
+
 struct display;
 struct mod_brightness;
 
@@ -9,3 +11,8 @@ void mod_brightness_destroy(struct mod_brightness*);
 // Returns the current brightness in percent.
 // A return code <0 means that the brightness couldn't be read.
 int mod_brightness_get(struct mod_brightness*);
+
+// Sets the brightness to the given percentage.
+// Returns false if the brightness couldn't be written.
+// Will display a banner.
+bool mod_brightness_set(struct mod_brightness*, unsigned percent);
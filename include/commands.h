@@ -0,0 +1,86 @@
+#pragma once
+
+#include <stdbool.h>
+
+// Registry of control commands.
+// A command is identified by its name (one or more words, e.g.
+// "audio add") and followed by its arguments, separated by spaces.
+// Lookup uses a hash table over the name so dispatch cost doesn't depend
+// on the number of registered commands.
+
+#define COMMAND_MAX_ARGS 2
+// Large enough for the 'stats' report with all sources, while still
+// fitting into one control reply packet (see CONTROL_MAX_REPLY).
+#define COMMAND_MAX_REPLY 2000
+
+enum command_arg {
+	command_arg_none = 0,
+	command_arg_int, // signed integer, e.g. '5', '+5' or '-5'
+	command_arg_pct, // percentage in [0, 100], optionally with '%' suffix
+	command_arg_string, // the rest of the line, must be the last argument
+};
+
+union command_value {
+	int i;
+	const char* str;
+};
+
+// How multiple calls of a command in the same batch are merged.
+// Only consecutive calls of foldable commands are merged, i.e. a
+// command with command_fold_none acts as barrier.
+enum command_fold {
+	command_fold_none = 0, // every call is executed on its own
+	// Calls with the same fold group are merged into one call, their
+	// values are summed up. Skipped if the sum is zero.
+	command_fold_sum,
+	// Calls with the same fold group cancel each other out in pairs.
+	command_fold_toggle,
+};
+
+struct command;
+struct command_call {
+	const struct command* command;
+	union command_value args[COMMAND_MAX_ARGS];
+	// The value of the call: the first argument for commands with an
+	// <int> argument, the static value of the command otherwise.
+	// Summed up when calls are folded.
+	int value;
+	// Short error description on failure, optional output on success.
+	char* reply;
+	unsigned reply_size;
+	void* source; // opaque issuer of the command, see command_line
+};
+
+// Executes the command. On failure, should write a description
+// into call->reply and return false. On success, output for the
+// issuer (e.g. a status query) can be written into call->reply.
+typedef bool (*command_fn)(const struct command_call*);
+
+struct command {
+	const char* name;
+	enum command_arg args[COMMAND_MAX_ARGS];
+	command_fn fn;
+	int value; // static value for the handler, e.g. volume step
+	enum command_fold fold;
+	// Commands with the same fold group are merged with each other,
+	// using the handler of the first call. Defaults to the command name.
+	const char* fold_group;
+};
+
+struct command_line {
+	const char* line; // command line, without newline
+	void* source; // passed on to the command, e.g. the control client
+	bool success; // whether the command succeeded
+	char reply[COMMAND_MAX_REPLY]; // error description or output
+};
+
+// Adds the given commands to the registry. The table must stay valid
+// as long as the registry is used. Names must be unique.
+void commands_register(const struct command* commands, unsigned count);
+
+// Parses and executes the given batch of command lines, in order.
+// Consecutive calls of foldable commands are merged before execution
+// (see enum command_fold), e.g. a burst of 'audio up' commands results
+// in just one volume change. Every line gets the result of the call
+// it was merged into.
+void commands_dispatch(struct command_line* lines, unsigned count);
@@ -0,0 +1,62 @@
+#pragma once
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <unistd.h>
+
+// Control socket protocol.
+// dui listens on a SOCK_SEQPACKET unix socket, so the kernel keeps
+// message boundaries and messages from multiple clients can't interleave.
+// Commands are terminated by a newline. A packet may contain multiple
+// commands and a command may be split over multiple packets of the same
+// connection; unterminated data is kept until the rest of the line arrives.
+// For every command, dui sends back exactly one packet with the
+// reply: "ok\n" on success or "error: <reason>\n" on failure.
+// Successful commands may append output lines to the "ok\n" line, e.g.
+// 'status' returns the current state as "key=value" lines (see status.h).
+// After 'subscribe <topics>', dui additionally sends event packets
+// whenever the state of a subscribed topic changes. They consist of
+// an "event\n" line followed by the "key=value" lines that changed.
+
+// Maximum size of a single command (including the newline).
+#define CONTROL_MAX_MSG 256u
+
+// Maximum size of a single packet.
+#define CONTROL_MAX_PACKET 4096u
+
+// Maximum size of a reply or event packet sent by dui.
+#define CONTROL_MAX_REPLY 2048u
+
+// Maximum length of a control socket path, see sockaddr_un.sun_path
+#define CONTROL_PATH_MAX 108u
+
+// Writes the path of the control socket into buf.
+// Will use $XDG_RUNTIME_DIR if set, /tmp otherwise.
+static inline void control_socket_path(char buf[static CONTROL_PATH_MAX]) {
+	const char* dir = getenv("XDG_RUNTIME_DIR");
+	if(dir && dir[0] != '\0') {
+		snprintf(buf, CONTROL_PATH_MAX, "%s/dui.sock", dir);
+	} else {
+		snprintf(buf, CONTROL_PATH_MAX, "/tmp/dui-%d.sock", (int) getuid());
+	}
+}
+
+struct control;
+struct modules;
+
+// Creates the control socket and registers it with the main loop.
+// Received commands are executed via commands_dispatch, once per
+// loop iteration. Also registers the 'status', 'subscribe <topics>'
+// and 'unsubscribe' commands, answered from the given modules.
+// Returns NULL on failure (e.g. when another instance is running).
+struct control* control_create(const struct modules*);
+void control_destroy(struct control*);
+
+// Marks the given status topics (see enum status_topic) as changed.
+// Subscribed clients are notified once per loop iteration, so this
+// is cheap to call and does nothing without subscribers.
+void control_publish(struct control*, unsigned topics);
+
+// Returns the subset of the given topics that at least one
+// client is subscribed to.
+unsigned control_subscribed(const struct control*, unsigned topics);
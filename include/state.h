@@ -0,0 +1,104 @@
+#pragma once
+
+#include <stdbool.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <limits.h>
+#include <stdatomic.h>
+#include <unistd.h>
+#include <time.h>
+#include <sys/syscall.h>
+#include <linux/futex.h>
+
+// Shared memory state export.
+// dui publishes the module state into a file with a fixed layout
+// (struct dui_state) that consumers can mmap read-only, so they can
+// read the state without any round trip to dui.
+// The file is kept when dui exits, so mappings stay valid over restarts;
+// dui_state_running is cleared on exit.
+//
+// The data is protected by a sequence counter: it is odd while dui is
+// writing, readers retry until they copied the data without the counter
+// changing. The counter is also a (shared) futex, so consumers can wait
+// for changes, see dui_state_wait.
+// The inline functions use syscall(2), i.e. consumers need _GNU_SOURCE
+// or _DEFAULT_SOURCE.
+
+#define DUI_STATE_MAGIC 0x31697564u // "dui1"
+#define DUI_STATE_VERSION 1u
+#define DUI_STATE_SONG_MAX 256u
+#define DUI_STATE_PATH_MAX 108u
+
+enum dui_state_flags {
+	dui_state_running = (1u << 0), // dui is running
+	// The respective module is available and its fields are valid
+	dui_state_audio = (1u << 1),
+	dui_state_music = (1u << 2),
+	dui_state_brightness = (1u << 3),
+	dui_state_power = (1u << 4),
+};
+
+struct dui_state_data {
+	uint32_t flags; // enum dui_state_flags
+	uint32_t volume; // percent
+	uint32_t muted;
+	int32_t brightness; // percent
+	uint32_t power_percent;
+	uint32_t power_charging;
+	float power_wattage; // negative if unknown
+	uint32_t music_state; // enum music_state, see music.h
+	char song[DUI_STATE_SONG_MAX]; // null-terminated utf-8, 'artist - title'
+};
+
+struct dui_state {
+	uint32_t magic;
+	uint32_t version;
+	_Atomic uint32_t seq; // sequence counter, odd while writing
+	uint32_t pad;
+	struct dui_state_data data;
+};
+
+_Static_assert(sizeof(_Atomic uint32_t) == sizeof(uint32_t),
+	"futex word must be 32 bit");
+
+// Writes the path of the state file into buf.
+// The file lives in $XDG_RUNTIME_DIR. Returns false if it isn't set,
+// dui doesn't export its state then.
+static inline bool dui_state_path(char buf[static DUI_STATE_PATH_MAX]) {
+	const char* dir = getenv("XDG_RUNTIME_DIR");
+	if(!dir || dir[0] == '\0') {
+		return false;
+	}
+
+	snprintf(buf, DUI_STATE_PATH_MAX, "%s/dui-state", dir);
+	return true;
+}
+
+// Copies a consistent snapshot of the data into out.
+// Returns the sequence number of the snapshot, to be passed to
+// dui_state_wait.
+static inline uint32_t dui_state_read(const struct dui_state* state,
+		struct dui_state_data* out) {
+	while(true) {
+		uint32_t seq = atomic_load_explicit(&state->seq, memory_order_acquire);
+		if(seq & 1u) {
+			continue; // dui is currently writing
+		}
+
+		memcpy(out, &state->data, sizeof(*out));
+		atomic_thread_fence(memory_order_acquire);
+		if(atomic_load_explicit(&state->seq, memory_order_relaxed) == seq) {
+			return seq;
+		}
+	}
+}
+
+// Blocks until the state changes, i.e. the sequence counter isn't
+// seq anymore, or the (relative) timeout expired. timeout may be NULL.
+// Returns immediately if it already changed. May wake up spuriously.
+static inline void dui_state_wait(const struct dui_state* state, uint32_t seq,
+		const struct timespec* timeout) {
+	syscall(SYS_futex, (void*) &state->seq, FUTEX_WAIT, seq, timeout, NULL, 0);
+}
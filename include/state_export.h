@@ -0,0 +1,17 @@
+#pragma once
+
+// dui side of the shared memory state export, see state.h for the
+// layout of the file and how consumers read it.
+
+struct state_export;
+struct modules;
+
+// Creates (or reuses) the state file and maps it.
+// Returns NULL on failure.
+struct state_export* state_export_create(const struct modules*);
+void state_export_destroy(struct state_export*);
+
+// Re-reads the state of the given topics (see enum status_topic)
+// from the modules and publishes it, if it changed.
+// Waiting consumers are woken up.
+void state_export_update(struct state_export*, unsigned topics);
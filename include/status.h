@@ -0,0 +1,38 @@
+#pragma once
+
+#include <stddef.h>
+
+// Machine-readable snapshot of the module states, used by the
+// 'status' and 'subscribe' control commands.
+// The state is written as 'key=value' lines, e.g. 'audio.volume=40'.
+// Keys of unavailable modules are omitted.
+
+struct modules;
+
+enum status_topic {
+	status_topic_audio = (1u << 0), // audio.volume, audio.muted
+	status_topic_music = (1u << 1), // music.state, music.song
+	status_topic_brightness = (1u << 2), // brightness.percent
+	// power.percent, power.charging, power.wattage
+	status_topic_power = (1u << 3),
+
+	status_topic_count = 4,
+	status_topic_all = (1u << status_topic_count) - 1,
+};
+
+// Maximum size of the formatted state of a single topic.
+#define STATUS_TOPIC_MAX 256u
+
+// Maximum size of the formatted state of all topics.
+#define STATUS_MAX (status_topic_count * STATUS_TOPIC_MAX)
+
+// Parses a space-separated list of topic names ('audio', 'music',
+// 'brightness', 'power' or 'all') into a mask of status_topic bits.
+// Returns 0 if the list contains an unknown name.
+unsigned status_parse_topics(const char* list);
+
+// Writes the current state of the given topics into buf, as
+// newline-terminated 'key=value' lines. Returns the number of bytes
+// written, without the null terminator.
+size_t status_format(const struct modules*, unsigned topics,
+	char* buf, size_t size);
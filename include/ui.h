@@ -1,6 +1,7 @@
 #pragma once
 
 #include <stdbool.h>
+#include <stdint.h>
 #include "banner.h"
 
 typedef struct _cairo_surface cairo_surface_t;
@@ -11,15 +12,51 @@ struct display;
 // draw
 struct ui;
 
+struct ui_rect {
+	int x, y, width, height;
+};
+
+#define UI_MAX_DAMAGE 24u
+
+// The regions of a surface changed by ui_draw_dashboard.
+struct ui_damage {
+	unsigned count;
+	struct ui_rect rects[UI_MAX_DAMAGE];
+};
+
 struct ui* ui_create(struct modules*);
 void ui_destroy(struct ui*);
 void ui_set_display(struct ui*, struct display*);
 
+// Returns the number of font cache lookups that were hits and misses.
+// Misses mean fontconfig matching and should only happen at startup
+// and when first drawing at another device scale.
+void ui_font_stats(struct ui*, uint64_t* hits, uint64_t* misses);
+
 // Draws the ui on the given cairo surface, with the given context for it.
 // If (banner == banner_none) will draw the dashboard, otherwise the
-// specified banner type.
+// specified banner type. width and height are in logical pixels, for
+// HiDPI output the surface should have a device scale
+// (cairo_surface_set_device_scale), text is rasterized for it.
 void ui_draw(struct ui*, cairo_t*, unsigned width, unsigned height, enum banner);
 
+// Draws the dashboard incrementally.
+// 'since' is the value returned by the call that drew the current contents
+// of the surface, or 0 if they are undefined (e.g. a new buffer).
+// Only the widgets that changed since then are rendered again, the
+// changed regions are written into damage (may be NULL).
+// Returns the stamp of the drawn contents.
+uint64_t ui_draw_dashboard(struct ui*, cairo_t*, unsigned width,
+	unsigned height, uint64_t since, struct ui_damage* damage);
+
+// Writes the regions of the dashboard that changed since the given stamp
+// into damage, e.g. relative to the previously presented frame.
+void ui_dashboard_damage(struct ui*, uint64_t since, struct ui_damage* damage);
+
+// Returns the smallest rect of device pixels that covers the given
+// logical rect at the given scale, e.g. for damage.
+struct ui_rect ui_rect_scale(struct ui_rect, double scale);
+
 // Passes the given pressed key to the ui.
 // The key is a linux key code. Returns whether the dashboard should
 // be closed.
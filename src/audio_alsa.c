@@ -13,6 +13,7 @@
 #include "audio.h"
 #include "display.h"
 #include "banner.h"
+#include "status.h"
 
 struct mod_audio {
 	snd_mixer_t* handle;
@@ -27,6 +28,7 @@ static int elem_callback(snd_mixer_elem_t* elem, unsigned int mask){
 	struct mod_audio* mod = (struct mod_audio*) snd_mixer_elem_get_callback_private(elem);
 	display_redraw(mod->dpy, banner_none);
 	display_show_banner(mod->dpy, banner_volume);
+	dui_status_changed(status_topic_audio);
 	return 0;
 }
 
@@ -52,6 +54,7 @@ static unsigned source_query(struct pml_custom* c, struct pollfd* fds,
 
 static void source_dispatch(struct pml_custom* c, struct pollfd* fds,
 		unsigned n_fds) {
+	uint64_t start = stats_now();
 	struct mod_audio* mod = (struct mod_audio*) pml_custom_get_data(c);
 	unsigned short revents;
 	snd_mixer_poll_descriptors_revents(mod->handle, fds, n_fds,
@@ -59,6 +62,7 @@ static void source_dispatch(struct pml_custom* c, struct pollfd* fds,
 	if(revents) {
 		snd_mixer_handle_events(mod->handle);
 	}
+	stats_record(stats_audio, start);
 }
 
 static const struct pml_custom_impl custom_impl = {
@@ -168,6 +172,19 @@ void mod_audio_cycle_output(struct mod_audio* mod) {
 }
 
 void mod_audio_add(struct mod_audio* mod, int percent) {
-	// TODO: we can implement that
-	printf("mod_audio_add: not implemented for alsa (yet)\n");
+	assert(mod && mod->elem);
+
+	long pvol, pmin, pmax;
+	snd_mixer_selem_get_playback_volume_range(mod->elem, &pmin, &pmax);
+	snd_mixer_selem_get_playback_volume(mod->elem, 0, &pvol);
+
+	pvol += lround(percent * (pmax - pmin) / 100.0);
+	pvol = pvol < pmin ? pmin : (pvol > pmax ? pmax : pvol);
+
+	// will trigger elem_callback, showing the banner
+	int err = snd_mixer_selem_set_playback_volume_all(mod->elem, pvol);
+	if(err < 0) {
+		printf("snd_mixer_selem_set_playback_volume_all: %s\n",
+			snd_strerror(err));
+	}
 }
@@ -9,6 +9,7 @@
 #include "shared.h"
 #include "display.h"
 #include "banner.h"
+#include "status.h"
 
 // TODO: continue!
 // basically just implementing the functionality of pactl
@@ -24,6 +25,7 @@ struct mod_audio {
 	bool initialized;
 	bool muted;
 	unsigned volume;
+	pa_cvolume cvolume; // raw per-channel volume of the default sink
 
 	// for cycle-output
 	const char* next_sink;
@@ -47,7 +49,11 @@ static void paml_io_cb(struct pml_io* io, unsigned revents) {
 		(revents & POLLOUT ? PA_IO_EVENT_OUTPUT : 0) |
 		(revents & POLLERR ? PA_IO_EVENT_ERROR : 0) |
 		(revents & POLLHUP ? PA_IO_EVENT_HANGUP : 0);
+	uint64_t start = stats_now();
+	uint64_t trace = trace_begin();
 	iod->cb(iod->api, (pa_io_event*) io, fd, pa_revents, iod->data);
+	trace_end("pulse io", trace);
+	stats_record(stats_audio, start);
 }
 
 static pa_io_event* paml_io_new(pa_mainloop_api* api, int fd,
@@ -105,7 +111,11 @@ static void paml_time_cb(struct pml_timer* t) {
 
 	struct timespec time = pml_timer_get_time(t);
 	struct timeval tv = {time.tv_sec, time.tv_nsec / 1000};
+	uint64_t start = stats_now();
+	uint64_t trace = trace_begin();
 	td->cb(td->api, (pa_time_event*) t, &tv, td->data);
+	trace_end("pulse timer", trace);
+	stats_record(stats_audio_timer, start);
 }
 
 static pa_time_event* paml_time_new(pa_mainloop_api* api,
@@ -160,7 +170,11 @@ struct paml_defer_data {
 static void paml_defer_cb(struct pml_defer* d) {
 	struct paml_defer_data* dd = pml_defer_get_data(d);
 	assert(dd->cb);
+	uint64_t start = stats_now();
+	uint64_t trace = trace_begin();
 	dd->cb(dd->api, (pa_defer_event*) d, dd->data);
+	trace_end("pulse defer", trace);
+	stats_record(stats_audio_defer, start);
 }
 
 static pa_defer_event* paml_defer_new(pa_mainloop_api* api,
@@ -234,6 +248,7 @@ static void get_sink_info_cb(pa_context* c, const pa_sink_info* i,
 
 	if(mod->default_sink && strcmp(mod->default_sink, i->name) == 0) {
 		mod->sink_idx = i->index;
+		mod->cvolume = i->volume;
 		bool mute = i->mute || pa_cvolume_is_muted(&i->volume);
 		uint64_t avg = pa_cvolume_avg(&i->volume);
 		unsigned p = (unsigned)((avg * 100 + (uint64_t)PA_VOLUME_NORM / 2) / (uint64_t)PA_VOLUME_NORM);
@@ -242,14 +257,19 @@ static void get_sink_info_cb(pa_context* c, const pa_sink_info* i,
 			mod->muted = mute;
 			mod->volume = p;
 
+			// the first reply fills in the initial values, status
+			// subscribers have to see them as well
+			dui_status_changed(status_topic_audio);
+
 			// kinda hacky workaround needed due to the async model of pulse
 			// with this we prevent the first reload we do to show a banner/redraw
 			if(mod->initialized) {
 				display_redraw(mod->dpy, banner_volume);
 				display_show_banner(mod->dpy, banner_volume);
 			}
-			mod->initialized = true;
 		}
+
+		mod->initialized = true;
 	}
 }
 
@@ -484,6 +504,26 @@ void mod_audio_cycle_output(struct mod_audio* mod) {
 }
 
 void mod_audio_add(struct mod_audio* mod, int percent) {
-	// TODO
-	printf("mod_audio_add: not implemented for pulse yet\n");
+	if(!mod->ready || mod->cvolume.channels == 0) {
+		printf("pulse audio module not in ready state\n");
+		return;
+	}
+
+	// more than the full range changes nothing anymore, clamping
+	// also keeps the step from overflowing
+	percent = percent < -100 ? -100 : (percent > 100 ? 100 : percent);
+
+	// we modify our local copy directly so that multiple changes
+	// in a row accumulate correctly before the server notifies us
+	pa_volume_t step = (pa_volume_t)
+		(((uint64_t) PA_VOLUME_NORM * abs(percent)) / 100);
+	if(percent > 0) {
+		pa_cvolume_inc_clamp(&mod->cvolume, step, PA_VOLUME_NORM);
+	} else {
+		pa_cvolume_dec(&mod->cvolume, step);
+	}
+
+	pa_operation* o = pa_context_set_sink_volume_by_index(mod->ctx,
+		mod->sink_idx, &mod->cvolume, complete_cb, NULL);
+	pa_operation_unref(o);
 }
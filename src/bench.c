@@ -0,0 +1,405 @@
+#define _POSIX_C_SOURCE 200809L
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <stdbool.h>
+#include <string.h>
+#include <cairo/cairo.h>
+#include <linux/input-event-codes.h>
+#include <pml.h>
+#include "shared.h"
+#include "display.h"
+#include "audio.h"
+#include "music.h"
+#include "power.h"
+#include "brightness.h"
+#include "notes.h"
+#include "ui.h"
+
+// dui-bench: renders the dashboard and all banners with fake module
+// state into an offscreen image surface and reports frame times and
+// allocations per frame. Also measures the throughput of the utf8
+// validation applied to external strings.
+// Usage: dui-bench [-n <frames>] [<case filter>]
+
+#define DEFAULT_FRAMES 200u
+#define WARMUP_FRAMES 10u
+#define MAX_NOTES 16u
+
+// allocation counting
+// The executable's malloc overrides the libc one for all shared
+// libraries as well (e.g. cairo, fontconfig), so this catches every
+// allocation done while drawing. Only available with glibc.
+#ifdef __GLIBC__
+void* __libc_malloc(size_t);
+void* __libc_calloc(size_t, size_t);
+void* __libc_realloc(void*, size_t);
+
+static unsigned long long alloc_count = 0u;
+
+void* malloc(size_t size) {
+	++alloc_count;
+	return __libc_malloc(size);
+}
+
+void* calloc(size_t n, size_t size) {
+	++alloc_count;
+	return __libc_calloc(n, size);
+}
+
+void* realloc(void* ptr, size_t size) {
+	++alloc_count;
+	return __libc_realloc(ptr, size);
+}
+
+#define ALLOC_COUNTING 1
+#else
+static unsigned long long alloc_count = 0u;
+#define ALLOC_COUNTING 0
+#endif
+
+// fake modules
+struct mod_audio {
+	unsigned volume;
+	bool muted;
+};
+
+struct mod_music {
+	enum music_state state;
+	const char* song;
+};
+
+struct mod_brightness {
+	int percent;
+};
+
+struct mod_power {
+	struct mod_power_status status;
+};
+
+struct mod_notes {
+	unsigned count;
+	struct note notes[MAX_NOTES];
+};
+
+unsigned mod_audio_get(struct mod_audio* m) { return m->volume; }
+bool mod_audio_get_muted(struct mod_audio* m) { return m->muted; }
+const char* mod_music_get_song(struct mod_music* m) { return m->song; }
+enum music_state mod_music_get_state(struct mod_music* m) { return m->state; }
+int mod_brightness_get(struct mod_brightness* m) { return m->percent; }
+struct mod_power_status mod_power_get(struct mod_power* m) { return m->status; }
+
+const struct note* mod_notes_get(struct mod_notes* m, unsigned* count) {
+	*count = m->count;
+	return m->notes;
+}
+
+void mod_notes_open(struct mod_notes* m, unsigned id) {}
+void mod_notes_delete(struct mod_notes* m, unsigned id) {}
+void mod_notes_archive(struct mod_notes* m, unsigned id) {}
+void mod_notes_create_note(struct mod_notes* m) {}
+
+// the parts of the daemon the ui needs
+static struct pml* pml;
+struct pml* dui_pml(void) { return pml; }
+void dui_exit(void) {}
+void display_redraw(struct display* dpy, enum banner banner) {}
+
+// cases
+enum text {
+	text_short,
+	text_long, // exceeds every layout width
+	text_unicode, // non-ascii, multi-byte and wide characters
+};
+
+// How dashboard frames are drawn
+enum update {
+	update_full, // redraw everything every frame
+	update_idle, // incremental, nothing changed
+	update_note, // incremental, the active note changes every frame
+};
+
+struct bench_case {
+	const char* name;
+	enum banner banner; // banner_none for the dashboard
+	unsigned width, height;
+	enum text text;
+	unsigned notes;
+	enum update update;
+};
+
+static const struct bench_case cases[] = {
+	{"dashboard", banner_none, 800, 500, text_short, 3, update_full},
+	{"dashboard-large", banner_none, 1920, 1080, text_short, 3, update_full},
+	{"dashboard-long-song", banner_none, 800, 500, text_long, 3, update_full},
+	{"dashboard-many-notes", banner_none, 800, 500, text_long, MAX_NOTES, update_full},
+	{"dashboard-unicode", banner_none, 800, 500, text_unicode, MAX_NOTES, update_full},
+	{"dashboard-idle", banner_none, 800, 500, text_short, 3, update_idle},
+	{"dashboard-note-move", banner_none, 800, 500, text_short, 3, update_note},
+	{"banner-volume", banner_volume, 400, 60, text_short, 0, update_full},
+	{"banner-volume-large", banner_volume, 800, 120, text_short, 0, update_full},
+	{"banner-brightness", banner_brightness, 400, 60, text_short, 0, update_full},
+	{"banner-battery", banner_battery, 400, 60, text_short, 0, update_full},
+	{"banner-music", banner_music, 400, 60, text_short, 0, update_full},
+	{"banner-music-large", banner_music, 800, 120, text_short, 0, update_full},
+	{"banner-music-long", banner_music, 400, 60, text_long, 0, update_full},
+	{"banner-music-unicode", banner_music, 400, 60, text_unicode, 0, update_full},
+};
+
+static const char* song_text(enum text text) {
+	switch(text) {
+		case text_long:
+			return "The Incredibly Long Name Of Some Artist Nobody Knows "
+				"feat. Another Artist, A Third One & The Orchestra - "
+				"An Even Longer Title (Extended Live Version, Remastered 2019) "
+				"[Bonus Track] - Part I: The Beginning Of The End";
+		case text_unicode:
+			return u8"Sigur Rós - Ágætis byrjun · 坂本龍一 - 戦場のメリークリスマス "
+				u8"· Мумий Тролль - Владивосток 2000 · 🎵🎶";
+		default:
+			return "Artist - Title";
+	}
+}
+
+static const char* note_text(enum text text, unsigned i) {
+	static const char* unicode[] = {
+		u8"Äpfel, Öl und Süßigkeiten für Übermorgen kaufen",
+		u8"会議の資料を準備する",
+		u8"Позвонить в банк насчёт карты",
+		u8"Fix the ‘smart quotes’ — and … ellipses ✓",
+	};
+
+	switch(text) {
+		case text_long:
+			return "Write the long overdue report about the state of the "
+				"project, including all the benchmarks, the regressions we "
+				"found and the plan for the next quarter";
+		case text_unicode:
+			return unicode[i % (sizeof(unicode) / sizeof(unicode[0]))];
+		default:
+			return "Buy milk";
+	}
+}
+
+static int cmp_u64(const void* a, const void* b) {
+	uint64_t va = *(const uint64_t*) a;
+	uint64_t vb = *(const uint64_t*) b;
+	return (va > vb) - (va < vb);
+}
+
+static uint64_t draw(struct ui* ui, cairo_t* cr, const struct bench_case* bc,
+		unsigned frame, uint64_t stamp) {
+	if(bc->update == update_full) {
+		ui_draw(ui, cr, bc->width, bc->height, bc->banner);
+		return 0u;
+	}
+
+	if(bc->update == update_note) {
+		ui_key(ui, (frame % 2) ? KEY_UP : KEY_DOWN);
+	}
+
+	return ui_draw_dashboard(ui, cr, bc->width, bc->height, stamp, NULL);
+}
+
+static void run(struct ui* ui, struct modules* modules,
+		const struct bench_case* bc, unsigned frames, uint64_t* times) {
+	modules->music->song = song_text(bc->text);
+	modules->notes->count = bc->notes;
+	for(unsigned i = 0u; i < bc->notes; ++i) {
+		modules->notes->notes[i].id = i;
+		modules->notes->notes[i].string = note_text(bc->text, i);
+	}
+
+	cairo_surface_t* surface = cairo_image_surface_create(CAIRO_FORMAT_ARGB32,
+		bc->width, bc->height);
+	cairo_t* cr = cairo_create(surface);
+
+	// warm up caches (fonts, glyphs) so they don't distort the results
+	uint64_t stamp = 0u;
+	for(unsigned i = 0u; i < WARMUP_FRAMES; ++i) {
+		stamp = draw(ui, cr, bc, i, stamp);
+	}
+
+	unsigned long long allocs = alloc_count;
+	uint64_t total_start = stats_now();
+	for(unsigned i = 0u; i < frames; ++i) {
+		uint64_t start = stats_now();
+		stamp = draw(ui, cr, bc, i, stamp);
+		cairo_surface_flush(surface);
+		times[i] = stats_now() - start;
+	}
+
+	uint64_t total = stats_now() - total_start;
+	allocs = alloc_count - allocs;
+
+	qsort(times, frames, sizeof(*times), cmp_u64);
+	double p50 = times[frames / 2] / (1000.0 * 1000.0);
+	double p99 = times[(frames * 99) / 100] / (1000.0 * 1000.0);
+	double fps = frames / (total / (1000.0 * 1000.0 * 1000.0));
+
+	char size[32];
+	snprintf(size, sizeof(size), "%ux%u", bc->width, bc->height);
+	printf("%-24s %-10s %9.1f %9.3f %9.3f ", bc->name, size, fps, p50, p99);
+	if(ALLOC_COUNTING) {
+		printf("%12.1f\n", (double) allocs / frames);
+	} else {
+		printf("%12s\n", "n/a");
+	}
+
+	cairo_destroy(cr);
+	cairo_surface_destroy(surface);
+}
+
+// utf8 validation, for strings entering the music and notes modules
+#define UTF8_BENCH_SIZE (64u * 1024u)
+
+struct utf8_case {
+	const char* name;
+	const char* text; // repeated to UTF8_BENCH_SIZE bytes
+};
+
+static const struct utf8_case utf8_cases[] = {
+	{"utf8-ascii", "Artist - Title (Extended Live Version, Remastered) "},
+	{"utf8-mixed", u8"Sigur Rós - Ágætis byrjun · Мумий Тролль - Владивосток "},
+	{"utf8-cjk", u8"坂本龍一 - 戦場のメリークリスマス 会議の資料を準備する "},
+};
+
+// the byte-at-a-time walk the ui used before
+static size_t utf8_walk(const char* str, size_t len) {
+	size_t count = 0u;
+	for(size_t i = 0u; i < len; i += utf8_length(str + i)) {
+		++count;
+	}
+	return count;
+}
+
+static double mbps(uint64_t ns, unsigned frames) {
+	return (double) UTF8_BENCH_SIZE * frames / (ns / 1000.0);
+}
+
+static void run_utf8(const struct utf8_case* uc, unsigned frames) {
+	char* text = malloc(UTF8_BENCH_SIZE);
+	char* out = malloc(UTF8_BENCH_SIZE + 1);
+	size_t tlen = strlen(uc->text);
+	size_t len = 0u;
+	while(len + tlen <= UTF8_BENCH_SIZE) {
+		memcpy(text + len, uc->text, tlen);
+		len += tlen;
+	}
+	memset(text + len, ' ', UTF8_BENCH_SIZE - len);
+
+	// results are accumulated so nothing gets optimized out
+	volatile size_t sink = 0u;
+	uint64_t start = stats_now();
+	for(unsigned i = 0u; i < frames; ++i) {
+		sink += utf8_walk(text, UTF8_BENCH_SIZE);
+	}
+	uint64_t walk = stats_now() - start;
+
+	start = stats_now();
+	for(unsigned i = 0u; i < frames; ++i) {
+		sink += utf8_validate_scalar(text, UTF8_BENCH_SIZE);
+	}
+	uint64_t scalar = stats_now() - start;
+
+	start = stats_now();
+	for(unsigned i = 0u; i < frames; ++i) {
+		sink += utf8_validate(text, UTF8_BENCH_SIZE);
+	}
+	uint64_t simd = stats_now() - start;
+
+	start = stats_now();
+	for(unsigned i = 0u; i < frames; ++i) {
+		sink += utf8_sanitize(out, UTF8_BENCH_SIZE + 1, text, UTF8_BENCH_SIZE);
+	}
+	uint64_t sanitize = stats_now() - start;
+
+	start = stats_now();
+	for(unsigned i = 0u; i < frames; ++i) {
+		sink += utf8_count(text, UTF8_BENCH_SIZE);
+	}
+	uint64_t count = stats_now() - start;
+	(void) sink;
+
+	printf("%-24s %9.0f %9.0f %9.0f %9.0f %9.0f\n", uc->name,
+		mbps(walk, frames), mbps(scalar, frames), mbps(simd, frames),
+		mbps(sanitize, frames), mbps(count, frames));
+
+	free(text);
+	free(out);
+}
+
+int main(int argc, char** argv) {
+	unsigned frames = DEFAULT_FRAMES;
+	const char* filter = NULL;
+	for(int i = 1; i < argc; ++i) {
+		if(strcmp(argv[i], "-n") == 0 && i + 1 < argc) {
+			frames = strtoul(argv[++i], NULL, 10);
+		} else if(argv[i][0] == '-') {
+			printf("Usage: %s [-n <frames>] [<case filter>]\n", argv[0]);
+			return EXIT_FAILURE;
+		} else {
+			filter = argv[i];
+		}
+	}
+
+	if(frames == 0) {
+		printf("Invalid number of frames\n");
+		return EXIT_FAILURE;
+	}
+
+	pml = pml_new();
+	if(!pml) {
+		return EXIT_FAILURE;
+	}
+
+	struct mod_audio audio = {.volume = 42};
+	struct mod_music music = {.state = music_state_playing};
+	struct mod_brightness brightness = {.percent = 70};
+	struct mod_power power = {.status = {.percent = 63, .wattage = 7.25f}};
+	struct mod_notes notes = {0};
+	struct modules modules = {
+		.audio = &audio,
+		.music = &music,
+		.notes = &notes,
+		.brightness = &brightness,
+		.power = &power,
+	};
+
+	struct ui* ui = ui_create(&modules);
+	uint64_t* times = calloc(frames, sizeof(*times));
+
+	printf("%-24s %-10s %9s %9s %9s %12s\n", "case", "size", "fps",
+		"p50 [ms]", "p99 [ms]", "allocs/frame");
+	for(unsigned i = 0u; i < sizeof(cases) / sizeof(cases[0]); ++i) {
+		if(filter && !strstr(cases[i].name, filter)) {
+			continue;
+		}
+
+		run(ui, &modules, &cases[i], frames, times);
+	}
+
+	bool header = false;
+	for(unsigned i = 0u; i < sizeof(utf8_cases) / sizeof(utf8_cases[0]); ++i) {
+		if(filter && !strstr(utf8_cases[i].name, filter)) {
+			continue;
+		}
+
+		if(!header) {
+			printf("\n%-24s %9s %9s %9s %9s %9s  [MB/s]\n", "case", "walk",
+				"scalar", "simd", "sanitize", "count");
+			header = true;
+		}
+
+		run_utf8(&utf8_cases[i], frames);
+	}
+
+	uint64_t hits, misses;
+	ui_font_stats(ui, &hits, &misses);
+	printf("font cache: %llu hits, %llu misses\n",
+		(unsigned long long) hits, (unsigned long long) misses);
+
+	free(times);
+	ui_destroy(ui);
+	pml_destroy(pml);
+}
@@ -6,11 +6,13 @@
 #include "shared.h"
 #include "brightness.h"
 #include "banner.h"
+#include "status.h"
 #include "display.h"
 
 #define BASE_PATH "/sys/class/backlight/intel_backlight/"
 static const char* path_max = BASE_PATH "max_brightness";
 static const char* path_current = BASE_PATH "actual_brightness";
+static const char* path_set = BASE_PATH "brightness";
 
 struct mod_brightness {
 	struct display* dpy;
@@ -48,6 +50,7 @@ static void callback(const struct inotify_event* ev, void* data) {
 	mod->percent = read_percent();
 	display_redraw(mod->dpy, banner_none);
 	display_show_banner(mod->dpy, banner_brightness);
+	dui_status_changed(status_topic_brightness);
 }
 
 struct mod_brightness* mod_brightness_create(struct display* dpy) {
@@ -71,3 +74,35 @@ void mod_brightness_destroy(struct mod_brightness* mod) {
 int mod_brightness_get(struct mod_brightness* mod) {
 	return mod->percent;
 }
+
+bool mod_brightness_set(struct mod_brightness* mod, unsigned percent) {
+	FILE* fdmax = fopen(path_max, "r");
+	if(!fdmax) {
+		return false;
+	}
+
+	char buf[32] = {0};
+	fread(buf, 1, 31, fdmax);
+	int max = atoi(buf);
+	fclose(fdmax);
+
+	// usually requires the user to be in the video group
+	FILE* fdset = fopen(path_set, "w");
+	if(!fdset) {
+		printf("brightness: can't open %s for writing\n", path_set);
+		return false;
+	}
+
+	percent = percent > 100 ? 100 : percent;
+	int value = round(max * (percent / 100.0));
+
+	bool success = fprintf(fdset, "%d\n", value) > 0;
+	success &= (fclose(fdset) == 0);
+	if(!success) {
+		return false;
+	}
+
+	// sysfs doesn't reliably notify us about our own write
+	callback(NULL, mod);
+	return true;
+}
@@ -0,0 +1,336 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <stdint.h>
+#include <string.h>
+#include <errno.h>
+#include <limits.h>
+#include "shared.h"
+#include "commands.h"
+
+// Size of the open-addressing hash table, must be a power of two.
+// Kept at least twice as large as the number of commands so probe
+// sequences stay short.
+#define TABLE_SIZE 128u
+#define MAX_LINE 256u
+
+struct entry {
+	uint32_t hash;
+	const struct command* command;
+};
+
+static struct {
+	unsigned count;
+	struct entry table[TABLE_SIZE];
+} ctx = {0};
+
+// FNV-1a, can be continued with the result of a previous call
+static uint32_t hash_append(uint32_t hash, const char* str, size_t len) {
+	for(size_t i = 0u; i < len; ++i) {
+		hash ^= (unsigned char) str[i];
+		hash *= 16777619u;
+	}
+	return hash;
+}
+
+static const uint32_t hash_init = 2166136261u;
+
+static const struct command* lookup(uint32_t hash, const char* name,
+		size_t len) {
+	for(unsigned i = 0u; i < TABLE_SIZE; ++i) {
+		struct entry* e = &ctx.table[(hash + i) & (TABLE_SIZE - 1)];
+		if(!e->command) {
+			return NULL;
+		}
+
+		if(e->hash == hash && strncmp(e->command->name, name, len) == 0 &&
+				e->command->name[len] == '\0') {
+			return e->command;
+		}
+	}
+
+	return NULL;
+}
+
+void commands_register(const struct command* commands, unsigned count) {
+	for(unsigned c = 0u; c < count; ++c) {
+		const struct command* cmd = &commands[c];
+		assert(ctx.count + 1 < TABLE_SIZE / 2 && "Too many commands");
+
+		size_t len = strlen(cmd->name);
+		uint32_t hash = hash_append(hash_init, cmd->name, len);
+		assert(!lookup(hash, cmd->name, len) && "Duplicate command");
+
+		unsigned i = hash & (TABLE_SIZE - 1);
+		while(ctx.table[i].command) {
+			i = (i + 1) & (TABLE_SIZE - 1);
+		}
+
+		ctx.table[i].hash = hash;
+		ctx.table[i].command = cmd;
+		++ctx.count;
+	}
+}
+
+static const char* arg_name(enum command_arg arg) {
+	switch(arg) {
+		case command_arg_int: return "<int>";
+		case command_arg_pct: return "<pct>";
+		case command_arg_string: return "<string>";
+		default: return "";
+	}
+}
+
+static void usage(const struct command* cmd, char* reply, unsigned reply_size) {
+	int len = snprintf(reply, reply_size, "usage: %s", cmd->name);
+	for(unsigned i = 0u; i < COMMAND_MAX_ARGS && len > 0 &&
+			(unsigned) len < reply_size; ++i) {
+		if(cmd->args[i] == command_arg_none) {
+			break;
+		}
+
+		len += snprintf(reply + len, reply_size - len, " %s",
+			arg_name(cmd->args[i]));
+	}
+}
+
+static bool parse_int(const char* str, int* out) {
+	errno = 0;
+	char* end;
+	long val = strtol(str, &end, 10);
+	if(errno || end == str || *end != '\0' || val < INT_MIN || val > INT_MAX) {
+		return false;
+	}
+
+	*out = val;
+	return true;
+}
+
+static bool parse_pct(char* str, int* out) {
+	size_t len = strlen(str);
+	if(len > 0 && str[len - 1] == '%') {
+		str[len - 1] = '\0';
+	}
+
+	return parse_int(str, out) && *out >= 0 && *out <= 100;
+}
+
+struct parsed {
+	bool valid;
+	char buf[MAX_LINE];
+	struct command_call call;
+	int leader; // index of the call this one is merged into, -1 if none
+	unsigned toggles;
+};
+
+static bool parse(struct parsed* p, struct command_line* line) {
+	char* reply = line->reply;
+	unsigned reply_size = sizeof(line->reply);
+
+	// normalize whitespace, words are separated by exactly one space
+	char* buf = p->buf;
+	unsigned len = 0u;
+	for(const char* it = line->line; *it != '\0'; ++it) {
+		bool space = (*it == ' ' || *it == '\t');
+		if(space && (len == 0 || buf[len - 1] == ' ')) {
+			continue;
+		}
+
+		if(len + 1 >= MAX_LINE) {
+			snprintf(reply, reply_size, "command too long");
+			return false;
+		}
+
+		buf[len++] = space ? ' ' : *it;
+	}
+
+	if(len > 0 && buf[len - 1] == ' ') {
+		--len;
+	}
+	buf[len] = '\0';
+
+	// find the longest command name that is a prefix of the line,
+	// at word boundaries
+	const struct command* cmd = NULL;
+	char* args = NULL;
+	uint32_t hash = hash_init;
+	char* word = buf;
+	while(*word != '\0') {
+		char* end = strchr(word, ' ');
+		if(!end) {
+			end = buf + len;
+		}
+
+		hash = hash_append(hash, word, end - word);
+		const struct command* found = lookup(hash, buf, end - buf);
+		if(found) {
+			cmd = found;
+			args = end;
+		}
+
+		if(*end == '\0') {
+			break;
+		}
+
+		hash = hash_append(hash, " ", 1);
+		word = end + 1;
+	}
+
+	if(!cmd) {
+		snprintf(reply, reply_size, "unknown command '%.64s'", buf);
+		return false;
+	}
+
+	struct command_call* call = &p->call;
+	call->command = cmd;
+	call->value = cmd->value;
+	call->reply = reply;
+	call->reply_size = reply_size;
+	call->source = line->source;
+
+	for(unsigned i = 0u; i < COMMAND_MAX_ARGS; ++i) {
+		enum command_arg type = cmd->args[i];
+		if(type == command_arg_none) {
+			break;
+		}
+
+		if(*args == '\0') {
+			usage(cmd, reply, reply_size);
+			return false;
+		}
+
+		char* arg = args + 1; // skip space
+		if(type == command_arg_string) {
+			call->args[i].str = arg;
+			args = buf + len;
+			break;
+		}
+
+		char* end = strchr(arg, ' ');
+		args = end ? end : buf + len;
+		if(end) {
+			*end = '\0';
+		}
+
+		bool valid = (type == command_arg_int) ?
+			parse_int(arg, &call->args[i].i) :
+			parse_pct(arg, &call->args[i].i);
+		if(!valid) {
+			usage(cmd, reply, reply_size);
+			return false;
+		}
+
+		if(end) {
+			*end = ' ';
+		}
+	}
+
+	if(*args != '\0') {
+		usage(cmd, reply, reply_size);
+		return false;
+	}
+
+	if(cmd->args[0] == command_arg_int) {
+		call->value = call->args[0].i;
+	}
+
+	return true;
+}
+
+static const char* fold_group(const struct command* cmd) {
+	return cmd->fold_group ? cmd->fold_group : cmd->name;
+}
+
+// a + b, saturated to the range of int.
+static int add_sat(int a, int b) {
+	int sum;
+	if(__builtin_add_overflow(a, b, &sum)) {
+		return b < 0 ? INT_MIN : INT_MAX;
+	}
+	return sum;
+}
+
+// Merges all valid calls in [begin, end), all of them must be foldable.
+static void fold(struct parsed* parsed, unsigned begin, unsigned end) {
+	for(unsigned i = begin; i < end; ++i) {
+		struct parsed* p = &parsed[i];
+		p->leader = -1;
+		if(!p->valid) {
+			continue;
+		}
+
+		const struct command* cmd = p->call.command;
+		for(unsigned j = begin; j < i; ++j) {
+			struct parsed* l = &parsed[j];
+			if(l->valid && l->leader < 0 &&
+					l->call.command->fold == cmd->fold &&
+					strcmp(fold_group(l->call.command), fold_group(cmd)) == 0) {
+				p->leader = j;
+				l->call.value = add_sat(l->call.value, p->call.value);
+				++l->toggles;
+				break;
+			}
+		}
+
+		if(p->leader < 0) {
+			p->toggles = 1;
+		}
+	}
+}
+
+static void execute(struct parsed* p, struct command_line* line) {
+	const struct command* cmd = p->call.command;
+	if((cmd->fold == command_fold_sum && p->call.value == 0) ||
+			(cmd->fold == command_fold_toggle && p->toggles % 2 == 0)) {
+		// folded calls cancelled each other out
+		line->success = true;
+		return;
+	}
+
+	uint64_t start = trace_begin();
+	line->success = cmd->fn(&p->call);
+	trace_end(cmd->name, start);
+}
+
+void commands_dispatch(struct command_line* lines, unsigned count) {
+	struct parsed* parsed = calloc(count, sizeof(*parsed));
+	for(unsigned i = 0u; i < count; ++i) {
+		lines[i].reply[0] = '\0';
+		lines[i].success = false;
+		parsed[i].valid = parse(&parsed[i], &lines[i]);
+		parsed[i].leader = -1;
+	}
+
+	unsigned begin = 0u;
+	while(begin < count) {
+		// find the run of foldable commands until the next barrier
+		unsigned end = begin;
+		while(end < count && (!parsed[end].valid ||
+				parsed[end].call.command->fold != command_fold_none)) {
+			++end;
+		}
+
+		fold(parsed, begin, end);
+		for(unsigned i = begin; i < end; ++i) {
+			if(parsed[i].valid && parsed[i].leader < 0) {
+				execute(&parsed[i], &lines[i]);
+			}
+		}
+
+		for(unsigned i = begin; i < end; ++i) {
+			int leader = parsed[i].leader;
+			if(leader >= 0) {
+				lines[i].success = lines[leader].success;
+				memcpy(lines[i].reply, lines[leader].reply, sizeof(lines[i].reply));
+			}
+		}
+
+		if(end < count) {
+			execute(&parsed[end], &lines[end]);
+			++end;
+		}
+
+		begin = end;
+	}
+
+	free(parsed);
+}
@@ -0,0 +1,617 @@
+#define _GNU_SOURCE
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <stdbool.h>
+#include <string.h>
+#include <errno.h>
+#include <unistd.h>
+#include <poll.h>
+#include <sys/types.h>
+#include <sys/socket.h>
+#include <sys/un.h>
+#include <sys/uio.h>
+#include <pml.h>
+#include "shared.h"
+#include "control.h"
+#include "commands.h"
+#include "status.h"
+
+// Size of the per-connection receive ring buffer, must be a power of two.
+// Since complete lines are always consumed right away, at most
+// CONTROL_MAX_MSG bytes remain in it between packets, so a full
+// packet always fits.
+#define RING_SIZE 8192u
+_Static_assert((RING_SIZE & (RING_SIZE - 1)) == 0, "RING_SIZE must be pow2");
+_Static_assert(RING_SIZE >= CONTROL_MAX_PACKET + CONTROL_MAX_MSG,
+	"RING_SIZE too small");
+_Static_assert(COMMAND_MAX_REPLY + 16 <= CONTROL_MAX_REPLY, "CONTROL_MAX_REPLY too small");
+_Static_assert(STATUS_MAX + 16 <= CONTROL_MAX_REPLY, "CONTROL_MAX_REPLY too small");
+_Static_assert(STATUS_MAX <= COMMAND_MAX_REPLY, "COMMAND_MAX_REPLY too small");
+
+// Maximum number of replies and events queued for a client that doesn't
+// read them. When exceeded, the connection is closed.
+#define MAX_QUEUED 64u
+
+struct ring {
+	char data[RING_SIZE];
+	// positions grow monotonically, wrapped on access
+	unsigned head; // start of unconsumed data
+	unsigned tail; // end of received data
+	unsigned scan; // data in [head, scan) is known to contain no newline
+};
+
+struct control_client {
+	int fd;
+	struct pml_io* io;
+	struct control* control;
+	struct ring ring;
+	bool discard; // discarding an overlong line until its newline
+
+	// Packets that didn't fit into the socket buffer yet, in order.
+	// Sent when the client becomes writable again.
+	unsigned queued_count;
+	char* queued[MAX_QUEUED];
+
+	unsigned topics; // subscribed status topics
+	// The state of each subscribed topic as last sent to the client.
+	// Events only contain the lines that differ from it.
+	char last[status_topic_count][STATUS_TOPIC_MAX];
+};
+
+// A received command that wasn't executed yet.
+struct pending {
+	struct control_client* client; // NULL if the client is already gone
+	char line[CONTROL_MAX_MSG];
+};
+
+struct control {
+	int fd;
+	struct pml_io* io;
+	char path[CONTROL_PATH_MAX];
+	const struct modules* modules;
+
+	unsigned client_count;
+	struct control_client** clients;
+
+	// Commands received in the current loop iteration. They are
+	// executed together in a deferred callback so that bursts can be
+	// merged, see commands_dispatch.
+	unsigned pending_count;
+	unsigned pending_cap;
+	struct pending* pending;
+	struct pml_defer* defer;
+
+	unsigned subscribed; // topics subscribed by at least one client
+	unsigned dirty; // changed topics, published in the deferred callback
+};
+
+static void update_subscribed(struct control* ctl) {
+	ctl->subscribed = 0u;
+	for(unsigned i = 0u; i < ctl->client_count; ++i) {
+		ctl->subscribed |= ctl->clients[i]->topics;
+	}
+}
+
+static void client_destroy(struct control_client* client) {
+	struct control* ctl = client->control;
+	for(unsigned i = 0u; i < ctl->client_count; ++i) {
+		if(ctl->clients[i] == client) {
+			--ctl->client_count;
+			memmove(ctl->clients + i, ctl->clients + i + 1,
+				sizeof(*ctl->clients) * (ctl->client_count - i));
+			break;
+		}
+	}
+
+	for(unsigned i = 0u; i < ctl->pending_count; ++i) {
+		if(ctl->pending[i].client == client) {
+			ctl->pending[i].client = NULL;
+		}
+	}
+
+	if(client->topics) {
+		update_subscribed(ctl);
+	}
+
+	for(unsigned i = 0u; i < client->queued_count; ++i) {
+		free(client->queued[i]);
+	}
+
+	pml_io_destroy(client->io);
+	close(client->fd);
+	free(client);
+}
+
+// Closes the connection to a client without destroying it, the client
+// is destroyed when the resulting POLLHUP is handled. Safe to call while iterating
+// over clients or pending commands.
+static void client_shutdown(struct control_client* client) {
+	shutdown(client->fd, SHUT_RDWR);
+	pml_io_set_events(client->io, POLLIN);
+}
+
+// Sends the queued packets, as many as fit into the socket buffer.
+static void client_send_queued(struct control_client* client) {
+	unsigned sent = 0u;
+	for(; sent < client->queued_count; ++sent) {
+		const char* packet = client->queued[sent];
+		ssize_t ret = send(client->fd, packet, strlen(packet),
+			MSG_NOSIGNAL | MSG_DONTWAIT);
+		if(ret < 0) {
+			if(errno != EAGAIN && errno != EWOULDBLOCK) {
+				client_shutdown(client);
+			}
+			break;
+		}
+
+		free(client->queued[sent]);
+	}
+
+	client->queued_count -= sent;
+	memmove(client->queued, client->queued + sent,
+		client->queued_count * sizeof(*client->queued));
+	if(client->queued_count == 0u) {
+		pml_io_set_events(client->io, POLLIN);
+	}
+}
+
+// Returns false if the reply could not be sent.
+static bool client_reply(struct control_client* client, const char* reply) {
+	// we never block on clients. If the socket buffer is full, the reply
+	// is queued. If a client doesn't read its replies at all, it is
+	// disconnected instead of dropping them silently, so it doesn't wait
+	// for them forever.
+	if(client->queued_count == 0u) {
+		ssize_t ret = send(client->fd, reply, strlen(reply),
+			MSG_NOSIGNAL | MSG_DONTWAIT);
+		if(ret >= 0) {
+			return true;
+		} else if(errno != EAGAIN && errno != EWOULDBLOCK) {
+			if(errno != EPIPE) {
+				printf("control: send failed: %s (%d)\n", strerror(errno), errno);
+			}
+			return false;
+		}
+	}
+
+	if(client->queued_count == MAX_QUEUED) {
+		printf("control: client doesn't read replies, disconnecting\n");
+		client_shutdown(client);
+		return false;
+	}
+
+	client->queued[client->queued_count++] = strdup(reply);
+	pml_io_set_events(client->io, POLLIN | POLLOUT);
+	return true;
+}
+
+// Returns whether text contains the given line as a whole line.
+static bool has_line(const char* text, const char* line, size_t len) {
+	while(*text != '\0') {
+		size_t tlen = strcspn(text, "\n");
+		if(tlen == len && strncmp(text, line, len) == 0) {
+			return true;
+		}
+
+		text += tlen;
+		text += (*text == '\n');
+	}
+
+	return false;
+}
+
+// Appends all lines of 'now' that are not part of 'last' to buf.
+static size_t append_delta(const char* last, const char* now,
+		char* buf, size_t size) {
+	size_t len = 0u;
+	while(*now != '\0') {
+		size_t llen = strcspn(now, "\n");
+		if(!has_line(last, now, llen) && len + llen + 1 < size) {
+			memcpy(buf + len, now, llen);
+			buf[len + llen] = '\n';
+			len += llen + 1;
+		}
+
+		now += llen;
+		now += (*now == '\n');
+	}
+
+	buf[len] = '\0';
+	return len;
+}
+
+// Sends the changes of all dirty topics to their subscribers.
+static void publish(struct control* ctl) {
+	unsigned dirty = ctl->dirty & ctl->subscribed;
+	ctl->dirty = 0u;
+	if(!dirty) {
+		return;
+	}
+
+	char now[status_topic_count][STATUS_TOPIC_MAX];
+	for(unsigned t = 0u; t < status_topic_count; ++t) {
+		if(dirty & (1u << t)) {
+			status_format(ctl->modules, 1u << t, now[t], sizeof(now[t]));
+		}
+	}
+
+	static const char header[] = "event\n";
+	char event[CONTROL_MAX_REPLY];
+	for(unsigned i = 0u; i < ctl->client_count; ++i) {
+		struct control_client* client = ctl->clients[i];
+		unsigned topics = client->topics & dirty;
+		if(!topics) {
+			continue;
+		}
+
+		size_t len = sizeof(header) - 1;
+		memcpy(event, header, len);
+		for(unsigned t = 0u; t < status_topic_count; ++t) {
+			if(topics & (1u << t)) {
+				len += append_delta(client->last[t], now[t],
+					event + len, sizeof(event) - len);
+			}
+		}
+
+		// if the event can't be sent, the client keeps its old state
+		// and gets the changes with the next event
+		if(len == sizeof(header) - 1 || !client_reply(client, event)) {
+			continue;
+		}
+
+		for(unsigned t = 0u; t < status_topic_count; ++t) {
+			if(topics & (1u << t)) {
+				memcpy(client->last[t], now[t], sizeof(now[t]));
+			}
+		}
+	}
+}
+
+void control_publish(struct control* ctl, unsigned topics) {
+	topics &= ctl->subscribed;
+	if(topics) {
+		ctl->dirty |= topics;
+		pml_defer_enable(ctl->defer, true);
+	}
+}
+
+// commands
+unsigned control_subscribed(const struct control* ctl, unsigned topics) {
+	return ctl->subscribed & topics;
+}
+
+static bool cmd_status(const struct command_call* call) {
+	struct control_client* client = call->source;
+	if(client) {
+		status_format(client->control->modules, status_topic_all,
+			call->reply, call->reply_size);
+	}
+	return true;
+}
+
+static bool cmd_subscribe(const struct command_call* call) {
+	unsigned topics = status_parse_topics(call->args[0].str);
+	if(!topics) {
+		snprintf(call->reply, call->reply_size, "unknown topic in '%.64s'",
+			call->args[0].str);
+		return false;
+	}
+
+	struct control_client* client = call->source;
+	if(!client) {
+		return true; // already disconnected
+	}
+
+	// reply with the current state of the new topics, following
+	// events only contain changes relative to it
+	size_t len = 0u;
+	for(unsigned t = 0u; t < status_topic_count; ++t) {
+		if(topics & (1u << t)) {
+			status_format(client->control->modules, 1u << t,
+				client->last[t], sizeof(client->last[t]));
+			len += snprintf(call->reply + len, call->reply_size - len,
+				"%s", client->last[t]);
+		}
+	}
+
+	client->topics |= topics;
+	update_subscribed(client->control);
+	dui_status_subscribed(topics);
+	return true;
+}
+
+static bool cmd_unsubscribe(const struct command_call* call) {
+	struct control_client* client = call->source;
+	if(client) {
+		client->topics = 0u;
+		update_subscribed(client->control);
+	}
+	return true;
+}
+
+static const struct command control_commands[] = {
+	{"status", {0}, cmd_status, 0, command_fold_none, NULL},
+	{"subscribe", {command_arg_string}, cmd_subscribe, 0, command_fold_none, NULL},
+	{"unsubscribe", {0}, cmd_unsubscribe, 0, command_fold_none, NULL},
+};
+
+static void handle_line(struct control_client* client, const char* msg) {
+	struct control* ctl = client->control;
+	if(ctl->pending_count == ctl->pending_cap) {
+		ctl->pending_cap = ctl->pending_cap ? 2 * ctl->pending_cap : 16u;
+		ctl->pending = realloc(ctl->pending,
+			ctl->pending_cap * sizeof(*ctl->pending));
+	}
+
+	struct pending* pending = &ctl->pending[ctl->pending_count++];
+	pending->client = client;
+	snprintf(pending->line, sizeof(pending->line), "%s", msg);
+	trace_instant("command received");
+	pml_defer_enable(ctl->defer, true);
+}
+
+// Executes all pending commands and publishes state changes.
+static void flush(struct control* ctl) {
+	unsigned count = ctl->pending_count;
+	if(count == 0) {
+		publish(ctl);
+		return;
+	}
+
+	struct command_line* lines = calloc(count, sizeof(*lines));
+	for(unsigned i = 0u; i < count; ++i) {
+		printf("Command: %s\n", ctl->pending[i].line);
+		lines[i].line = ctl->pending[i].line;
+		lines[i].source = ctl->pending[i].client;
+	}
+
+	commands_dispatch(lines, count);
+
+	char answer[CONTROL_MAX_REPLY];
+	for(unsigned i = 0u; i < count; ++i) {
+		if(lines[i].success) {
+			snprintf(answer, sizeof(answer), "ok\n%s", lines[i].reply);
+		} else {
+			printf("Command '%s' failed: %s\n", lines[i].line, lines[i].reply);
+			snprintf(answer, sizeof(answer), "error: %s\n",
+				lines[i].reply[0] ? lines[i].reply : "failed");
+		}
+
+		if(ctl->pending[i].client) {
+			client_reply(ctl->pending[i].client, answer);
+		}
+	}
+
+	free(lines);
+	ctl->pending_count = 0u;
+
+	// changes caused by the commands are sent after their replies
+	publish(ctl);
+}
+
+static void flush_pending(struct pml_defer* defer) {
+	uint64_t start = stats_now();
+	struct control* ctl = pml_defer_get_data(defer);
+	pml_defer_enable(defer, false);
+	flush(ctl);
+	stats_record(stats_commands, start);
+}
+
+// Executes all complete lines in the ring buffer.
+// Incomplete lines are kept until the rest arrives.
+static void process_ring(struct control_client* client) {
+	struct ring* ring = &client->ring;
+	for(; ring->scan != ring->tail; ++ring->scan) {
+		if(ring->data[ring->scan & (RING_SIZE - 1)] != '\n') {
+			continue;
+		}
+
+		unsigned len = ring->scan - ring->head;
+		if(client->discard || len >= CONTROL_MAX_MSG) {
+			if(!client->discard) {
+				client_reply(client, "error: message too long\n");
+			}
+			client->discard = false;
+		} else {
+			char line[CONTROL_MAX_MSG];
+			for(unsigned i = 0u; i < len; ++i) {
+				line[i] = ring->data[(ring->head + i) & (RING_SIZE - 1)];
+			}
+			line[len] = '\0';
+			handle_line(client, line);
+		}
+
+		ring->head = ring->scan + 1;
+	}
+
+	// drop the start of overlong lines right away so they can't fill the
+	// buffer. The rest of the line is discarded when it arrives.
+	if(ring->tail - ring->head >= CONTROL_MAX_MSG) {
+		printf("control: message too long\n");
+		client_reply(client, "error: message too long\n");
+		client->discard = true;
+		ring->head = ring->tail;
+	} else if(client->discard) {
+		ring->head = ring->tail;
+	}
+}
+
+static void read_packets(struct control_client* client, unsigned revents) {
+	struct ring* ring = &client->ring;
+
+	// read all packets queued on this connection, directly into
+	// the free space of the ring buffer
+	while(true) {
+		assert(ring->tail - ring->head <= CONTROL_MAX_MSG);
+		unsigned start = ring->tail & (RING_SIZE - 1);
+		unsigned free = RING_SIZE - (ring->tail - ring->head);
+		unsigned first = RING_SIZE - start;
+		first = first < free ? first : free;
+
+		struct iovec iov[2] = {
+			{ .iov_base = ring->data + start, .iov_len = first },
+			{ .iov_base = ring->data, .iov_len = free - first },
+		};
+		struct msghdr msg = {
+			.msg_iov = iov,
+			.msg_iovlen = 2,
+		};
+
+		// with seqpacket sockets, 0 is returned for empty packets too.
+		// A hangup is detected via POLLHUP, either now or on the
+		// next poll, since the remaining packets are still readable
+		ssize_t ret = recvmsg(client->fd, &msg, MSG_DONTWAIT);
+		if(ret == 0) {
+			break;
+		} else if(ret < 0) {
+			if(errno == EAGAIN || errno == EWOULDBLOCK || errno == EINTR) {
+				break;
+			}
+
+			printf("control: recv failed: %s (%d)\n", strerror(errno), errno);
+			client_destroy(client);
+			return;
+		}
+
+		if(msg.msg_flags & MSG_TRUNC) {
+			// only possible if the packet is larger than allowed.
+			// Drop it completely
+			printf("control: packet too large\n");
+			client_reply(client, "error: packet too large\n");
+			continue;
+		}
+
+		ring->tail += ret;
+		process_ring(client);
+	}
+
+	if(revents & (POLLHUP | POLLERR)) {
+		client_destroy(client);
+	}
+}
+
+static void client_read(struct pml_io* io, unsigned revents) {
+	uint64_t start = stats_now();
+	struct control_client* client = pml_io_get_data(io);
+	if((revents & POLLOUT) && client->queued_count) {
+		client_send_queued(client);
+	}
+
+	read_packets(client, revents);
+	stats_record(stats_control, start);
+}
+
+static void control_accept(struct pml_io* io, unsigned revents) {
+	(void) revents;
+	uint64_t start = stats_now();
+	struct control* ctl = pml_io_get_data(io);
+
+	int fd;
+	while((fd = accept4(ctl->fd, NULL, NULL, SOCK_CLOEXEC | SOCK_NONBLOCK)) >= 0) {
+		struct control_client* client = calloc(1, sizeof(*client));
+		client->fd = fd;
+		client->control = ctl;
+		client->io = pml_io_new(dui_pml(), fd, POLLIN, client_read);
+		pml_io_set_data(client->io, client);
+
+		++ctl->client_count;
+		ctl->clients = realloc(ctl->clients,
+			ctl->client_count * sizeof(*ctl->clients));
+		ctl->clients[ctl->client_count - 1] = client;
+	}
+
+	if(errno != EAGAIN && errno != EWOULDBLOCK && errno != EINTR) {
+		printf("control: accept failed: %s (%d)\n", strerror(errno), errno);
+	}
+
+	stats_record(stats_control, start);
+}
+
+// Returns whether there is a dui instance listening on the given socket.
+static bool socket_alive(const struct sockaddr_un* addr) {
+	int fd = socket(AF_UNIX, SOCK_SEQPACKET | SOCK_CLOEXEC, 0);
+	if(fd < 0) {
+		return false;
+	}
+
+	bool alive = connect(fd, (const struct sockaddr*) addr, sizeof(*addr)) == 0;
+	close(fd);
+	return alive;
+}
+
+struct control* control_create(const struct modules* modules) {
+	struct control* ctl = calloc(1, sizeof(*ctl));
+	ctl->modules = modules;
+	control_socket_path(ctl->path);
+
+	ctl->fd = socket(AF_UNIX, SOCK_SEQPACKET | SOCK_CLOEXEC | SOCK_NONBLOCK, 0);
+	if(ctl->fd < 0) {
+		printf("control: socket failed: %s (%d)\n", strerror(errno), errno);
+		free(ctl);
+		return NULL;
+	}
+
+	struct sockaddr_un addr = {0};
+	addr.sun_family = AF_UNIX;
+	snprintf(addr.sun_path, sizeof(addr.sun_path), "%s", ctl->path);
+
+	int ret = bind(ctl->fd, (struct sockaddr*) &addr, sizeof(addr));
+	if(ret != 0 && errno == EADDRINUSE) {
+		// A socket file left behind by a crashed instance can simply
+		// be removed. If someone is still listening on it, bail out.
+		if(socket_alive(&addr)) {
+			printf("%s is in use. Another instance running?\n", ctl->path);
+			close(ctl->fd);
+			free(ctl);
+			return NULL;
+		}
+
+		unlink(ctl->path);
+		ret = bind(ctl->fd, (struct sockaddr*) &addr, sizeof(addr));
+	}
+
+	if(ret != 0) {
+		printf("control: bind on %s failed: %s (%d)\n", ctl->path,
+			strerror(errno), errno);
+		close(ctl->fd);
+		free(ctl);
+		return NULL;
+	}
+
+	if(listen(ctl->fd, 16) != 0) {
+		printf("control: listen failed: %s (%d)\n", strerror(errno), errno);
+		control_destroy(ctl);
+		return NULL;
+	}
+
+	ctl->io = pml_io_new(dui_pml(), ctl->fd, POLLIN, control_accept);
+	pml_io_set_data(ctl->io, ctl);
+
+	ctl->defer = pml_defer_new(dui_pml(), flush_pending);
+	pml_defer_set_data(ctl->defer, ctl);
+	pml_defer_enable(ctl->defer, false);
+
+	commands_register(control_commands,
+		sizeof(control_commands) / sizeof(control_commands[0]));
+	return ctl;
+}
+
+void control_destroy(struct control* ctl) {
+	while(ctl->client_count) {
+		client_destroy(ctl->clients[ctl->client_count - 1]);
+	}
+
+	free(ctl->clients);
+	free(ctl->pending);
+	if(ctl->defer) pml_defer_destroy(ctl->defer);
+	if(ctl->io) pml_io_destroy(ctl->io);
+	if(ctl->fd >= 0) {
+		close(ctl->fd);
+		if(unlink(ctl->path) < 0) {
+			printf("unlink failed: %s (%d)\n", strerror(errno), errno);
+		}
+	}
+
+	free(ctl);
+}
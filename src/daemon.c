@@ -8,12 +8,6 @@
 #include <time.h>
 #include <errno.h>
 
-#include <unistd.h>
-#include <sys/poll.h>
-#include <sys/types.h>
-#include <sys/stat.h>
-#include <fcntl.h>
-
 #include <pml.h>
 #include "shared.h"
 #include "display.h"
@@ -23,10 +17,22 @@
 #include "power.h"
 #include "notes.h"
 #include "ui.h"
+#include "control.h"
+#include "commands.h"
+#include "status.h"
+#include "state_export.h"
+
+// The power module has no change notifications, its state
+// is polled with this interval (in seconds).
+#define POWER_POLL_INTERVAL 10
 
 struct context {
-	int fifo;
 	struct pml* pml;
+	struct control* control;
+	struct state_export* state;
+	struct pml_timer* power_timer;
+	bool power_polling; // power_timer is armed
+	struct pml_defer* init_defer; // creates pending modules
 
 	struct ui* ui;
 	struct display* display;
@@ -34,63 +40,153 @@ struct context {
 	bool run;
 } ctx = {0};
 
-// messages are simple strings
-// they are always expected to end with a newline
-static void handle_msg(char* msg, unsigned length) {
-	assert(length > 0);
-	char* newline = strchr(msg, '\n');
-	if(!newline) {
-		printf("Incomplete message: '%s'\n", msg);
-		return;
+static void init_module(enum dui_module module);
+
+// Returns whether the given module is available.
+// Creates it first if it's still pending.
+static bool available(enum dui_module module) {
+	if(ctx.modules.loading & module) {
+		init_module(module);
+	}
+
+	switch(module) {
+		case dui_module_audio: return ctx.modules.audio;
+		case dui_module_music: return ctx.modules.music;
+		case dui_module_notes: return ctx.modules.notes;
+		case dui_module_brightness: return ctx.modules.brightness;
+		case dui_module_power: return ctx.modules.power;
+		default: return false;
 	}
+}
 
-	*newline = '\0';
-	printf("Command: %s\n", msg);
-	if(strcmp(msg, "music next") == 0) {
-		if(ctx.modules.music) mod_music_next(ctx.modules.music);
-	} else if(strcmp(msg, "music prev") == 0) {
-		if(ctx.modules.music) mod_music_prev(ctx.modules.music);
-	} else if(strcmp(msg, "music toggle") == 0) {
-		if(ctx.modules.music) mod_music_toggle(ctx.modules.music);
-	} else if(strcmp(msg, "dashboard toggle") == 0) {
-		display_toggle_dashboard(ctx.display);
-	} else if(strcmp(msg, "audio cycle-output") == 0) {
-		if(ctx.modules.audio) mod_audio_cycle_output(ctx.modules.audio);
-	} else if(strcmp(msg, "audio up") == 0) {
-		if(ctx.modules.audio) mod_audio_add(ctx.modules.audio, 5);
-	} else if(strcmp(msg, "audio down") == 0) {
-		if(ctx.modules.audio) mod_audio_add(ctx.modules.audio, -5);
-	} else if(strcmp(msg, "exit") == 0) {
-		ctx.run = false;
-	} else {
-		printf("Unknown message: '%s'\n", msg);
-	}
-}
-
-static void fifo_read(struct pml_io* io, unsigned revents) {
-	(void) revents;
-
-	int fd = pml_io_get_fd(io);
-	char buf[256];
-	int ret = read(fd, buf, sizeof(buf) - 1);
-	if(ret > 0) {
-		buf[ret] = '\0';
-		handle_msg(buf, ret);
-	}
-
-	while(ret > 0 && ret == sizeof(buf) - 1) {
-		ret = read(fd, buf, sizeof(buf) - 1);
-		if(ret > 0) {
-			buf[ret] = '\0';
-			handle_msg(buf, ret);
+static bool unavailable(const struct command_call* call, const char* module) {
+	snprintf(call->reply, call->reply_size, "%s module not available", module);
+	return false;
+}
+
+// music
+// 'music next' and 'music prev' are merged, the value is the number
+// of songs to skip
+static bool cmd_music_skip(const struct command_call* call) {
+	if(!available(dui_module_music)) return unavailable(call, "music");
+	for(int i = 0; i < abs(call->value); ++i) {
+		if(call->value > 0) {
+			mod_music_next(ctx.modules.music);
+		} else {
+			mod_music_prev(ctx.modules.music);
 		}
 	}
+	return true;
+}
+
+static bool cmd_music_toggle(const struct command_call* call) {
+	if(!available(dui_module_music)) return unavailable(call, "music");
+	mod_music_toggle(ctx.modules.music);
+	return true;
+}
+
+static const struct command music_commands[] = {
+	{"music next", {0}, cmd_music_skip, 1, command_fold_sum, "music skip"},
+	{"music prev", {0}, cmd_music_skip, -1, command_fold_sum, "music skip"},
+	{"music toggle", {0}, cmd_music_toggle, 0, command_fold_toggle, NULL},
+};
+
+// audio
+// 'audio up' and 'audio down' use the static command value as step.
+// All of them are merged into one volume change.
+static bool cmd_audio_add(const struct command_call* call) {
+	if(!available(dui_module_audio)) return unavailable(call, "audio");
+	mod_audio_add(ctx.modules.audio, call->value);
+	return true;
+}
+
+static bool cmd_audio_cycle_output(const struct command_call* call) {
+	if(!available(dui_module_audio)) return unavailable(call, "audio");
+	mod_audio_cycle_output(ctx.modules.audio);
+	return true;
+}
+
+static const struct command audio_commands[] = {
+	{"audio up", {0}, cmd_audio_add, 5, command_fold_sum, "audio volume"},
+	{"audio down", {0}, cmd_audio_add, -5, command_fold_sum, "audio volume"},
+	{"audio add", {command_arg_int}, cmd_audio_add, 0, command_fold_sum, "audio volume"},
+	{"audio cycle-output", {0}, cmd_audio_cycle_output, 0, command_fold_none, NULL},
+};
+
+// brightness
+static bool cmd_brightness_set(const struct command_call* call) {
+	if(!available(dui_module_brightness)) return unavailable(call, "brightness");
+	if(!mod_brightness_set(ctx.modules.brightness, call->args[0].i)) {
+		snprintf(call->reply, call->reply_size, "failed to set brightness");
+		return false;
+	}
+	return true;
+}
 
-	if(ret < 0) {
-		printf("fifo read failed: %s (%d)\n", strerror(errno), errno);
+static bool cmd_brightness_add(const struct command_call* call) {
+	if(!available(dui_module_brightness)) return unavailable(call, "brightness");
+	int value = call->value;
+	value = value < -100 ? -100 : (value > 100 ? 100 : value);
+	int percent = mod_brightness_get(ctx.modules.brightness) + value;
+	percent = percent < 0 ? 0 : (percent > 100 ? 100 : percent);
+	if(!mod_brightness_set(ctx.modules.brightness, percent)) {
+		snprintf(call->reply, call->reply_size, "failed to set brightness");
+		return false;
 	}
+	return true;
+}
+
+static const struct command brightness_commands[] = {
+	{"brightness set", {command_arg_pct}, cmd_brightness_set, 0, command_fold_none, NULL},
+	{"brightness add", {command_arg_int}, cmd_brightness_add, 0, command_fold_sum, NULL},
+};
+
+// general
+static bool cmd_dashboard_toggle(const struct command_call* call) {
+	display_toggle_dashboard(ctx.display);
+	return true;
+}
+
+static bool cmd_exit(const struct command_call* call) {
+	ctx.run = false;
+	return true;
+}
+
+static bool cmd_stats(const struct command_call* call) {
+	size_t len = stats_format(call->reply, call->reply_size);
+	uint64_t hits, misses;
+	ui_font_stats(ctx.ui, &hits, &misses);
+	snprintf(call->reply + len, call->reply_size - len,
+		"font cache: hits=%llu misses=%llu\n",
+		(unsigned long long) hits, (unsigned long long) misses);
+	return true;
 }
 
+static bool cmd_trace_dump(const struct command_call* call) {
+	if(!trace_enabled()) {
+		snprintf(call->reply, call->reply_size,
+			"tracing disabled, set DUI_TRACE to the output path");
+		return false;
+	}
+
+	if(!trace_dump()) {
+		snprintf(call->reply, call->reply_size, "failed to write trace");
+		return false;
+	}
+
+	return true;
+}
+
+static const struct command dui_commands[] = {
+	{"dashboard toggle", {0}, cmd_dashboard_toggle, 0, command_fold_toggle, NULL},
+	{"exit", {0}, cmd_exit, 0, command_fold_none, NULL},
+	{"stats", {0}, cmd_stats, 0, command_fold_none, NULL},
+	{"trace dump", {0}, cmd_trace_dump, 0, command_fold_none, NULL},
+};
+
+#define REGISTER_COMMANDS(table) \
+	commands_register(table, sizeof(table) / sizeof(table[0]))
+
 struct pml* dui_pml(void) {
 	return ctx.pml;
 }
@@ -99,40 +195,152 @@ void dui_exit(void) {
 	ctx.run = false;
 }
 
-int main() {
-	ctx.pml = pml_new();
-	if(!ctx.pml) {
-		return EXIT_FAILURE;
+void dui_status_changed(unsigned topics) {
+	if(ctx.control) {
+		control_publish(ctx.control, topics);
+	}
+	if(ctx.state) {
+		state_export_update(ctx.state, topics);
+	}
+}
+
+// Arms the power timer if someone may consume the power status.
+// Readers of the state export map it read-only and can't be tracked,
+// so while it exists, power is polled permanently. Otherwise only
+// while a client is subscribed to it. The dashboard reads the state
+// itself when drawing.
+static void poll_power(void) {
+	bool watched = ctx.state || (ctx.control &&
+		control_subscribed(ctx.control, status_topic_power));
+	if(!ctx.power_timer || ctx.power_polling || !watched) {
+		return;
+	}
+
+	struct timespec ts = { .tv_sec = POWER_POLL_INTERVAL };
+	pml_timer_set_time_rel(ctx.power_timer, ts);
+	ctx.power_polling = true;
+}
+
+void dui_status_subscribed(unsigned topics) {
+	if(topics & status_topic_power) {
+		poll_power();
+	}
+}
+
+static void power_timer_cb(struct pml_timer* timer) {
+	(void) timer;
+	uint64_t start = stats_now();
+	ctx.power_polling = false;
+	dui_status_changed(status_topic_power);
+	poll_power();
+	stats_record(stats_power_timer, start);
+}
+
+static void init_module(enum dui_module module) {
+	const char* name = "";
+	unsigned topics = 0u;
+	bool created = false;
+
+	struct timespec start, end;
+	clock_gettime(CLOCK_MONOTONIC, &start);
+
+	switch(module) {
+		case dui_module_audio:
+			name = "audio";
+			topics = status_topic_audio;
+			ctx.modules.audio = mod_audio_create(ctx.display);
+			created = ctx.modules.audio;
+			break;
+		case dui_module_music:
+			name = "music";
+			topics = status_topic_music;
+			ctx.modules.music = mod_music_create(ctx.display);
+			created = ctx.modules.music;
+			break;
+		case dui_module_notes:
+			name = "notes";
+			ctx.modules.notes = mod_notes_create(ctx.display);
+			created = ctx.modules.notes;
+			break;
+		case dui_module_brightness:
+			name = "brightness";
+			topics = status_topic_brightness;
+			ctx.modules.brightness = mod_brightness_create(ctx.display);
+			created = ctx.modules.brightness;
+			break;
+		case dui_module_power:
+			name = "power";
+			topics = status_topic_power;
+			ctx.modules.power = mod_power_create(ctx.display);
+			created = ctx.modules.power;
+			if(created) {
+				ctx.power_timer = pml_timer_new(ctx.pml, NULL, power_timer_cb);
+				pml_timer_set_clock(ctx.power_timer, CLOCK_MONOTONIC);
+				poll_power();
+			}
+			break;
 	}
 
-	// init daemon fifo
-	// EEXIST simply means that the file already exists. We just
-	// assume that it is a pipe from a previous process of this
-	// program.
-	const char* fifo_path = "/tmp/.dui-pipe";
-	int ret = mkfifo(fifo_path, 0666);
-	if(ret != 0) {
-		if(errno == EEXIST) {
-			printf("/tmp/.dui-pipe already exists. Another instance running?\n"
-				"In case a previous instance crashed, remove that file manually\n");
-			return 2;
+	clock_gettime(CLOCK_MONOTONIC, &end);
+	float ms = 1000.f * (end.tv_sec - start.tv_sec) +
+		(end.tv_nsec - start.tv_nsec) / (1000.f * 1000.f);
+	printf("%s module %s (%.2f ms)\n", name,
+		created ? "initialized" : "not available", ms);
+
+	ctx.modules.loading &= ~module;
+	if(topics) {
+		dui_status_changed(topics);
+	}
+	display_redraw(ctx.display, banner_none);
+}
+
+// Creates one pending module per main loop iteration so that
+// display and control events are handled in between.
+// The cheap modules come first so the dashboard fills up quickly.
+static void init_defer_cb(struct pml_defer* defer) {
+	uint64_t start = stats_now();
+	static const enum dui_module order[] = {
+		dui_module_power,
+		dui_module_brightness,
+		dui_module_audio,
+		dui_module_notes,
+		dui_module_music,
+	};
+
+	for(unsigned i = 0u; i < sizeof(order) / sizeof(order[0]); ++i) {
+		if(ctx.modules.loading & order[i]) {
+			init_module(order[i]);
+			break;
 		}
+	}
 
-		printf("mkfifo failed: %s (%d)\n", strerror(errno), errno);
-		return 3;
+	if(!ctx.modules.loading) {
+		pml_defer_enable(defer, false);
+		stats_startup_done();
 	}
 
-	// we use O_RDWR here since that won't close our side of the pipe
-	// when a writer closes their side. We never write to it though.
-	// See the excellent post on https://stackoverflow.com/questions/15055065
-	// for details. Linux specific
-	ctx.fifo = open(fifo_path, O_NONBLOCK | O_CLOEXEC | O_RDWR);
-	if(ctx.fifo < 0) {
-		printf("open on fifo failed: %s (%d)\n", strerror(errno), errno);
+	stats_record(stats_module_init, start);
+}
+
+int main() {
+	ctx.pml = pml_new();
+	if(!ctx.pml) {
 		return EXIT_FAILURE;
 	}
 
-	pml_io_new(ctx.pml, ctx.fifo, POLLIN, fifo_read);
+	stats_init();
+	trace_init();
+
+	// init control socket
+	REGISTER_COMMANDS(dui_commands);
+	REGISTER_COMMANDS(music_commands);
+	REGISTER_COMMANDS(audio_commands);
+	REGISTER_COMMANDS(brightness_commands);
+
+	ctx.control = control_create(&ctx.modules);
+	if(!ctx.control) {
+		return 2;
+	}
 
 	// try to create all modules
 	ctx.ui = ui_create(&ctx.modules);
@@ -145,21 +353,27 @@ int main() {
 	}
 
 	ui_set_display(ctx.ui, ctx.display);
-	ctx.modules.music = mod_music_create(ctx.display);
-	ctx.modules.audio = mod_audio_create(ctx.display);
-	ctx.modules.notes = mod_notes_create(ctx.display);
-	ctx.modules.brightness = mod_brightness_create(ctx.display);
-	ctx.modules.power = mod_power_create(ctx.display);
+
+	// optional, only a warning is printed on failure
+	ctx.state = state_export_create(&ctx.modules);
+
+	// modules are created from the main loop, see init_defer_cb
+	ctx.modules.loading = dui_module_audio | dui_module_music |
+		dui_module_notes | dui_module_brightness | dui_module_power;
+	ctx.init_defer = pml_defer_new(ctx.pml, init_defer_cb);
 
 	ctx.run = true;
 	while(ctx.run) {
 		pml_iterate(ctx.pml, true);
+		stats_iteration();
 	}
 
-	if(unlink(fifo_path) < 0) {
-		printf("unlink failed: %s (%d)\n", strerror(errno), errno);
-	}
-
+	stats_finish();
+	trace_finish();
+	control_destroy(ctx.control);
+	pml_defer_destroy(ctx.init_defer);
+	if(ctx.power_timer) pml_timer_destroy(ctx.power_timer);
+	if(ctx.state) state_export_destroy(ctx.state);
 	if(ctx.modules.power) mod_power_destroy(ctx.modules.power);
 	if(ctx.modules.music) mod_music_destroy(ctx.modules.music);
 	if(ctx.modules.audio) mod_audio_destroy(ctx.modules.audio);
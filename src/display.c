@@ -1,26 +1,46 @@
 #include "config.h"
 #include "display.h"
 #include <stdlib.h>
+#include <stdio.h>
+#include <string.h>
+#include <stdbool.h>
 
 // from the respective backend files
 struct display* display_create_wl(struct ui* ui);
 struct display* display_create_x11(struct ui* ui);
+struct display* display_create_headless(struct ui* ui);
 
 struct display* display_create(struct ui* ui) {
-	struct display* dpy;
+	// DUI_DISPLAY may select a backend: 'wayland', 'x11' or 'headless'.
+	// The headless backend is never chosen automatically.
+	const char* backend = getenv("DUI_DISPLAY");
+	bool any = !backend || backend[0] == '\0';
+	if(!any && strcmp(backend, "headless") == 0) {
+		return display_create_headless(ui);
+	}
 
-#ifdef WITH_WL
-	if((dpy = display_create_wl(ui))) {
-		return dpy;
+#if WITH_WL
+	if(any || strcmp(backend, "wayland") == 0) {
+		struct display* dpy = display_create_wl(ui);
+		if(dpy) {
+			return dpy;
+		}
 	}
 #endif
 
-#ifdef WITH_X11
-	if((dpy = display_create_x11(ui))) {
-		return dpy;
+#if WITH_X11
+	if(any || strcmp(backend, "x11") == 0) {
+		struct display* dpy = display_create_x11(ui);
+		if(dpy) {
+			return dpy;
+		}
 	}
 #endif
 
+	if(!any) {
+		printf("Display backend '%s' not available\n", backend);
+	}
+
 	return NULL;
 }
 
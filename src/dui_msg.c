@@ -1,38 +1,269 @@
 #define _POSIX_C_SOURCE 200809L
 
 #include <stdio.h>
-#include <stdio.h>
+#include <stdbool.h>
 #include <unistd.h>
 #include <errno.h>
 #include <string.h>
 #include <stdlib.h>
+#include <poll.h>
 #include <sys/types.h>
-#include <sys/stat.h>
-#include <fcntl.h>
+#include <sys/socket.h>
+#include <sys/un.h>
+#include "control.h"
+
+static void usage(const char* name) {
+	printf("Usage: %s <command...> [, <command...>]...\n"
+		"       %s --stdin | -\n\n"
+		"Arguments are joined to one command, i.e. '%s audio up'\n"
+		"and \"%s 'audio up'\" both send 'audio up'. A ',' argument\n"
+		"separates commands, so multiple commands can be sent at once:\n"
+		"%s audio up , music next.\n"
+		"With --stdin, every line read from stdin is forwarded as command\n"
+		"over one persistent connection.\n"
+		"Output of commands (e.g. 'status') and events of subscriptions\n"
+		"are printed to stdout. After 'subscribe <topics>', %s keeps\n"
+		"running and prints the changed 'key=value' lines.\n",
+		name, name, name, name, name, name);
+}
+
+static int connect_dui(void) {
+	char path[CONTROL_PATH_MAX];
+	control_socket_path(path);
+
+	int fd = socket(AF_UNIX, SOCK_SEQPACKET | SOCK_CLOEXEC, 0);
+	if(fd < 0) {
+		printf("socket failed: %s (%d)\n", strerror(errno), errno);
+		return -1;
+	}
+
+	struct sockaddr_un addr = {0};
+	addr.sun_family = AF_UNIX;
+	snprintf(addr.sun_path, sizeof(addr.sun_path), "%s", path);
+	if(connect(fd, (struct sockaddr*) &addr, sizeof(addr)) != 0) {
+		printf("connect to %s failed: %s (%d)\n", path, strerror(errno), errno);
+		close(fd);
+		return -1;
+	}
+
+	return fd;
+}
+
+enum packet {
+	packet_ok, // successful reply
+	packet_error, // error reply
+	packet_event, // subscription event
+	packet_failed, // nothing could be read
+};
+
+// Reads one packet from dui and prints errors, the output of
+// successful commands and the content of events.
+static enum packet read_packet(int fd) {
+	char packet[CONTROL_MAX_REPLY + 1];
+	ssize_t ret = recv(fd, packet, sizeof(packet) - 1, 0);
+	if(ret <= 0) {
+		printf("Didn't receive a reply: %s\n", ret < 0 ? strerror(errno) :
+			"connection closed");
+		return packet_failed;
+	}
+
+	packet[ret] = '\0';
+
+	enum packet type = packet_error;
+	const char* output = packet;
+	if(strncmp(packet, "ok\n", 3) == 0) {
+		type = packet_ok;
+		output += 3;
+	} else if(strncmp(packet, "event\n", 6) == 0) {
+		type = packet_event;
+		output += 6;
+	}
+
+	printf("%s", output);
+	fflush(stdout);
+	return type;
+}
+
+// Sends the given newline-separated commands as one packet
+static bool send_packet(int fd, const char* buf, size_t len) {
+	if(send(fd, buf, len, MSG_NOSIGNAL) < 0) {
+		printf("send failed: %s (%d)\n", strerror(errno), errno);
+		return false;
+	}
+
+	return true;
+}
+
+// Forwards every line from stdin over one connection.
+// Replies are read concurrently so that sending never waits
+// for a round trip.
+static int run_stdin(int fd) {
+	char buf[CONTROL_MAX_PACKET];
+	size_t len = 0u; // data in buf
+	unsigned pending = 0u; // number of commands without reply
+	unsigned failed = 0u;
+	bool eof = false;
+
+	while(!eof || pending > 0) {
+		struct pollfd fds[2] = {
+			{ .fd = fd, .events = POLLIN },
+			{ .fd = STDIN_FILENO, .events = POLLIN },
+		};
+
+		int ret = poll(fds, eof ? 1 : 2, -1);
+		if(ret < 0) {
+			if(errno == EINTR) {
+				continue;
+			}
+
+			printf("poll failed: %s (%d)\n", strerror(errno), errno);
+			return EXIT_FAILURE;
+		}
+
+		if(fds[0].revents) {
+			enum packet res = read_packet(fd);
+			if(res == packet_failed) {
+				return EXIT_FAILURE;
+			} else if(res != packet_event) {
+				failed += (res == packet_error);
+				--pending;
+			}
+		}
+
+		if(eof || !fds[1].revents) {
+			continue;
+		}
+
+		ssize_t count = read(STDIN_FILENO, buf + len, sizeof(buf) - len);
+		if(count < 0) {
+			if(errno == EINTR || errno == EAGAIN) {
+				continue;
+			}
+
+			printf("read failed: %s (%d)\n", strerror(errno), errno);
+			return EXIT_FAILURE;
+		} else if(count == 0) {
+			eof = true;
+			if(len > 0) { // last line without newline
+				buf[len++] = '\n';
+			}
+		}
+
+		len += count;
+
+		// send all complete lines in one packet, keep the rest
+		size_t end = len;
+		while(end > 0 && buf[end - 1] != '\n') {
+			--end;
+		}
+
+		if(end == 0) {
+			if(len == sizeof(buf)) {
+				printf("Command too long\n");
+				return EXIT_FAILURE;
+			}
+			continue;
+		}
+
+		for(size_t i = 0u; i < end; ++i) {
+			pending += (buf[i] == '\n');
+		}
+
+		if(!send_packet(fd, buf, end)) {
+			return EXIT_FAILURE;
+		}
+
+		memmove(buf, buf + end, len - end);
+		len -= end;
+	}
+
+	return failed ? EXIT_FAILURE : EXIT_SUCCESS;
+}
 
 int main(int argc, const char** argv) {
-	const char* fifo_path = "/tmp/.dui-pipe";
-	int fd = open(fifo_path, O_WRONLY);
+	if(argc < 2 || strcmp(argv[1], "--help") == 0 ||
+			strcmp(argv[1], "-h") == 0) {
+		usage(argv[0]);
+		return argc < 2 ? EXIT_FAILURE : EXIT_SUCCESS;
+	}
+
+	bool stream = argc == 2 && (strcmp(argv[1], "-") == 0 ||
+		strcmp(argv[1], "--stdin") == 0);
+	if(stream) {
+		int fd = connect_dui();
+		if(fd < 0) {
+			return EXIT_FAILURE;
+		}
+
+		int ret = run_stdin(fd);
+		close(fd);
+		return ret;
+	}
+
+	// build the commands
+	char msg[CONTROL_MAX_PACKET];
+	size_t len = 0;
+	unsigned count = 0;
+	bool joining = false; // whether we currently append to a command
+	bool follow = false; // whether to wait for subscription events
+	for(int i = 1; i < argc; ++i) {
+		if(strcmp(argv[i], ",") == 0) {
+			if(joining) {
+				msg[len - 1] = '\n'; // finish previous command
+				joining = false;
+			}
+			continue;
+		}
+
+		if(!joining && strncmp(argv[i], "subscribe", 9) == 0) {
+			follow = true;
+		}
+
+		int ret = snprintf(msg + len, sizeof(msg) - len, "%s ", argv[i]);
+		if(ret < 0 || (size_t) ret >= sizeof(msg) - len) {
+			printf("Command too long\n");
+			return EXIT_FAILURE;
+		}
+
+		len += ret;
+		if(!joining) {
+			joining = true;
+			++count;
+		}
+	}
+
+	if(count == 0) {
+		usage(argv[0]);
+		return EXIT_FAILURE;
+	}
+
+	msg[len - 1] = '\n';
+
+	int fd = connect_dui();
 	if(fd < 0) {
-		printf("open on fifo failed: %s (%d)\n", strerror(errno), errno);
 		return EXIT_FAILURE;
 	}
 
-	struct stat st;
-	if(fstat(fd, &st) || !S_ISFIFO(st.st_mode)) {
-		printf("%s isn't fifo\n", fifo_path);
+	// all commands are sent as one packet so they can't interleave
+	// with commands from other clients
+	if(!send_packet(fd, msg, len)) {
+		close(fd);
 		return EXIT_FAILURE;
 	}
 
-	// TODO: might interleave with other commands.
-	// probably a fifo isn't the best for this
-	for(int i = 1; i < argc; ++i) {
-		if(i != 1) {
-			write(fd, " ", 1);
+	unsigned failed = 0u;
+	unsigned replies = 0u;
+	while(replies < count || (follow && !failed)) {
+		enum packet res = read_packet(fd);
+		if(res == packet_failed) {
+			close(fd);
+			return EXIT_FAILURE;
+		} else if(res != packet_event) {
+			failed += (res == packet_error);
+			++replies;
 		}
-		write(fd, argv[i], strlen(argv[i]));
 	}
 
-	write(fd, "\n", 1);
 	close(fd);
+	return failed ? EXIT_FAILURE : EXIT_SUCCESS;
 }
@@ -0,0 +1,213 @@
+#define _POSIX_C_SOURCE 200809L
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <stdbool.h>
+#include <string.h>
+#include <errno.h>
+#include <time.h>
+
+#include <cairo/cairo.h>
+
+#include <pml.h>
+#include "shared.h"
+#include "display.h"
+#include "ui.h"
+
+// Offscreen backend that renders into an in-memory image surface.
+// Works without any compositor, e.g. for benchmarks and regression runs
+// driven via the control socket. Selected with DUI_DISPLAY=headless.
+// When DUI_HEADLESS_DUMP is set to a directory, every frame is written
+// into it, as png or (with DUI_HEADLESS_FORMAT=raw) as raw ARGB32 data
+// in native byte order.
+
+struct display_headless {
+	struct display display;
+	struct ui* ui;
+
+	unsigned width, height;
+	enum banner banner; // whether a banner is active.
+	bool dashboard; // dashboard currently mapped
+
+	cairo_surface_t* surface;
+	cairo_t* cr;
+	uint64_t stamp; // dashboard contents of the surface, see ui_draw_dashboard
+
+	// redraws are merged and done once per loop iteration,
+	// like the frame callbacks of the real backends
+	struct pml_defer* defer;
+	struct pml_timer* timer;
+
+	const char* dump_dir;
+	bool dump_raw;
+	unsigned frame_count;
+	unsigned redraw_count; // requested redraws, including merged ones
+	uint64_t draw_time; // total ui_draw time, in ns
+};
+
+static void dump_frame(struct display_headless* dpy) {
+	char path[512];
+	if(dpy->dump_raw) {
+		snprintf(path, sizeof(path), "%s/frame-%05u-%ux%u.argb",
+			dpy->dump_dir, dpy->frame_count, dpy->width, dpy->height);
+
+		FILE* f = fopen(path, "wb");
+		if(!f) {
+			printf("headless: can't open %s: %s (%d)\n", path,
+				strerror(errno), errno);
+			return;
+		}
+
+		const unsigned char* data = cairo_image_surface_get_data(dpy->surface);
+		int stride = cairo_image_surface_get_stride(dpy->surface);
+		for(unsigned y = 0u; y < dpy->height; ++y) {
+			fwrite(data + y * stride, 4, dpy->width, f);
+		}
+
+		fclose(f);
+	} else {
+		snprintf(path, sizeof(path), "%s/frame-%05u.png",
+			dpy->dump_dir, dpy->frame_count);
+		cairo_status_t status = cairo_surface_write_to_png(dpy->surface, path);
+		if(status != CAIRO_STATUS_SUCCESS) {
+			printf("headless: writing %s failed: %s\n", path,
+				cairo_status_to_string(status));
+		}
+	}
+}
+
+static void resize(struct display_headless* dpy, unsigned width,
+		unsigned height) {
+	if(dpy->surface && dpy->width == width && dpy->height == height) {
+		return;
+	}
+
+	if(dpy->cr) cairo_destroy(dpy->cr);
+	if(dpy->surface) cairo_surface_destroy(dpy->surface);
+
+	dpy->width = width;
+	dpy->height = height;
+	dpy->stamp = 0u;
+	dpy->surface = cairo_image_surface_create(CAIRO_FORMAT_ARGB32,
+		width, height);
+	dpy->cr = cairo_create(dpy->surface);
+}
+
+static void draw(struct display_headless* dpy) {
+	if(!dpy->dashboard && dpy->banner == banner_none) {
+		return;
+	}
+
+	uint64_t start = stats_now();
+	if(dpy->dashboard) {
+		dpy->stamp = ui_draw_dashboard(dpy->ui, dpy->cr, dpy->width,
+			dpy->height, dpy->stamp, NULL);
+	} else {
+		ui_draw(dpy->ui, dpy->cr, dpy->width, dpy->height, dpy->banner);
+		dpy->stamp = 0u;
+	}
+	cairo_surface_flush(dpy->surface);
+	dpy->draw_time += stats_now() - start;
+
+	++dpy->frame_count;
+	if(dpy->dump_dir) {
+		dump_frame(dpy);
+	}
+}
+
+static void defer_cb(struct pml_defer* defer) {
+	uint64_t start = stats_now();
+	struct display_headless* dpy = pml_defer_get_data(defer);
+	pml_defer_enable(defer, false);
+	draw(dpy);
+	stats_record(stats_display, start);
+}
+
+static void schedule(struct display_headless* dpy) {
+	++dpy->redraw_count;
+	pml_defer_enable(dpy->defer, true);
+}
+
+static void timer_cb(struct pml_timer* timer) {
+	uint64_t start = stats_now();
+	struct display_headless* dpy = pml_timer_get_data(timer);
+	dpy->banner = banner_none;
+	stats_record(stats_display_timer, start);
+}
+
+static void toggle_dashboard(struct display* base) {
+	struct display_headless* dpy = (struct display_headless*) base;
+	dpy->dashboard = !dpy->dashboard;
+	if(dpy->dashboard) {
+		pml_timer_disable(dpy->timer);
+		dpy->banner = banner_none;
+		resize(dpy, start_width, start_height);
+		schedule(dpy);
+	}
+}
+
+static void show_banner(struct display* base, enum banner banner) {
+	struct display_headless* dpy = (struct display_headless*) base;
+	// don't show any banners while the dashboard is active
+	if(dpy->dashboard) {
+		return;
+	}
+
+	dpy->banner = banner;
+	resize(dpy, banner_width, banner_height);
+	schedule(dpy);
+
+	struct timespec ts = { .tv_sec = banner_time };
+	pml_timer_set_time_rel(dpy->timer, ts);
+}
+
+static void redraw(struct display* base, enum banner banner) {
+	struct display_headless* dpy = (struct display_headless*) base;
+	if(dpy->dashboard || (dpy->banner != banner_none && dpy->banner == banner)) {
+		schedule(dpy);
+	}
+}
+
+static void destroy(struct display* base) {
+	struct display_headless* dpy = (struct display_headless*) base;
+	printf("headless: %u frames for %u redraws, ui_draw %.3f ms/frame\n",
+		dpy->frame_count, dpy->redraw_count, dpy->frame_count ?
+			dpy->draw_time / (1000.0 * 1000.0 * dpy->frame_count) : 0.0);
+
+	if(dpy->defer) pml_defer_destroy(dpy->defer);
+	if(dpy->timer) pml_timer_destroy(dpy->timer);
+	if(dpy->cr) cairo_destroy(dpy->cr);
+	if(dpy->surface) cairo_surface_destroy(dpy->surface);
+}
+
+static const struct display_impl headless_impl = {
+	.destroy = destroy,
+	.toggle_dashboard = toggle_dashboard,
+	.redraw = redraw,
+	.show_banner = show_banner,
+};
+
+struct display* display_create_headless(struct ui* ui) {
+	struct display_headless* dpy = calloc(1, sizeof(*dpy));
+	dpy->display.impl = &headless_impl;
+	dpy->ui = ui;
+
+	const char* dir = getenv("DUI_HEADLESS_DUMP");
+	if(dir && dir[0] != '\0') {
+		const char* format = getenv("DUI_HEADLESS_FORMAT");
+		dpy->dump_dir = dir;
+		dpy->dump_raw = format && strcmp(format, "raw") == 0;
+	}
+
+	resize(dpy, start_width, start_height);
+
+	dpy->defer = pml_defer_new(dui_pml(), defer_cb);
+	pml_defer_set_data(dpy->defer, dpy);
+	pml_defer_enable(dpy->defer, false);
+
+	dpy->timer = pml_timer_new(dui_pml(), NULL, timer_cb);
+	pml_timer_set_data(dpy->timer, dpy);
+	pml_timer_set_clock(dpy->timer, CLOCK_MONOTONIC);
+
+	return &dpy->display;
+}
@@ -23,6 +23,7 @@ static struct {
 
 static void poll_handler(struct pml_io* io, unsigned revents) {
 	(void) revents;
+	uint64_t start = stats_now();
 
 	char buffer[8192];
 	ssize_t nr;
@@ -41,6 +42,8 @@ static void poll_handler(struct pml_io* io, unsigned revents) {
 			n = sizeof(struct inotify_event) + ev->len;
 		}
 	}
+
+	stats_record(stats_inotify, start);
 }
 
 int add_inotify_watch(const char* pathname, uint32_t mask,
@@ -13,6 +13,7 @@
 #include "music.h"
 #include "display.h"
 #include "banner.h"
+#include "status.h"
 
 struct mod_music {
 	struct display* dpy;
@@ -53,7 +54,12 @@ static void mpd_fill(struct mod_music* mpd) {
 	if(!title) {
 		title = "<unknown>";
 	}
-	snprintf(mpd->songbuf, sizeof(mpd->songbuf), "%s - %s", artist, title);
+	// tags aren't guaranteed to be valid utf-8 and the formatted
+	// string may be cut in the middle of a character
+	char buf[2 * sizeof(mpd->songbuf)];
+	int len = snprintf(buf, sizeof(buf), "%s - %s", artist, title);
+	len = len < (int) sizeof(buf) ? len : (int) sizeof(buf) - 1;
+	utf8_sanitize(mpd->songbuf, sizeof(mpd->songbuf), buf, len);
 
 	struct mpd_status* status = mpd_run_status(mpd->connection);
 	mpd->state = (enum music_state) mpd_status_get_state(status);
@@ -62,14 +68,17 @@ static void mpd_fill(struct mod_music* mpd) {
 
 static void mpd_read(struct ml_io* io, unsigned revents) {
 	(void) revents;
+	uint64_t start = stats_now();
 	struct mod_music* mpd = (struct mod_music*) ml_io_get_data(io);
 
 	if(mpd_run_noidle(mpd->connection) == MPD_IDLE_PLAYER) {
 		mpd_fill(mpd);
 		display_redraw(mpd->dpy, banner_music);
+		dui_status_changed(status_topic_music);
 	}
 
 	mpd_send_idle_mask(mpd->connection, MPD_IDLE_PLAYER);
+	stats_record(stats_music, start);
 }
 
 struct mod_music* mod_music_create(struct display* dpy) {
@@ -9,6 +9,7 @@
 #include "music.h"
 #include "display.h"
 #include "banner.h"
+#include "status.h"
 
 #define MAX_PLAYER_COUNT 16
 
@@ -70,7 +71,12 @@ static void reload_state(struct mod_music* pc) {
 	if(!artist) artist = "<unknown>";
 	if(!title) title = "<unknown>";
 
-	snprintf(pc->songbuf, sizeof(pc->songbuf), "%s - %s", artist, title);
+	// tags aren't guaranteed to be valid utf-8 and the formatted
+	// string may be cut in the middle of a character
+	char buf[2 * sizeof(pc->songbuf)];
+	int len = snprintf(buf, sizeof(buf), "%s - %s", artist, title);
+	len = len < (int) sizeof(buf) ? len : (int) sizeof(buf) - 1;
+	utf8_sanitize(pc->songbuf, sizeof(pc->songbuf), buf, len);
 	g_free(gartist);
 	g_free(gtitle);
 
@@ -79,6 +85,7 @@ static void reload_state(struct mod_music* pc) {
 	// Needed since e.g. mpd has something like seektime as metadata,
 	// which changes *really* often.
 	display_redraw(pc->dpy, banner_music);
+	dui_status_changed(status_topic_music);
 	// printf("state: %d, song: %s\n", (int) pc->state, pc->songbuf);
 }
 
@@ -140,6 +147,7 @@ static gboolean status_callback(PlayerctlPlayer* player,
 			select_player(pc);
 		} else {
 			display_redraw(pc->dpy, banner_music);
+			dui_status_changed(status_topic_music);
 		}
 	} else if(status == PLAYERCTL_PLAYBACK_STATUS_PLAYING && (pc->state != music_state_playing)) {
 		change_player(pc, player);
@@ -153,6 +161,7 @@ static gboolean metadata_callback(PlayerctlPlayer* player, GVariant* metadata,
 	assert(player == pc->player);
 	reload_state(pc);
 	display_redraw(pc->dpy, banner_music);
+	dui_status_changed(status_topic_music);
 	return true;
 }
 
@@ -210,9 +219,11 @@ static unsigned glib_query(struct pml_custom* c, struct pollfd* fds,
 }
 
 static void glib_dispatch(struct pml_custom* c, struct pollfd* fds, unsigned n_fds) {
+	uint64_t start = stats_now();
 	GMainContext* ctx = pml_custom_get_data(c);
 	g_main_context_check(ctx, INT_MAX, (GPollFD*) fds, n_fds);
 	g_main_context_dispatch(ctx);
+	stats_record(stats_music, start);
 }
 
 static const struct pml_custom_impl glib_custom_impl = {
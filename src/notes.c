@@ -54,12 +54,13 @@ static void reload(struct mod_notes* notes) {
 		unsigned id = sqlite3_column_int(notes->stmt_query, 0);
 		const char* content = (const char*) sqlite3_column_text(notes->stmt_query, 1);
 		const char* ptr = strchr(content, '\n');
-		unsigned len = (ptr ? (size_t)(ptr - content) : strlen(content)) + 1;
-		len = len < 256 ? len : 256;
+		size_t len = ptr ? (size_t)(ptr - content) : strlen(content);
 
-		char* buf = calloc(1, len);
-		strncpy(buf, content, len - 1);
-		buf[len - 1] = '\0';
+		// only the first line is shown, cut at a character boundary
+		char line[256];
+		len = utf8_sanitize(line, sizeof(line), content, len);
+		char* buf = malloc(len + 1);
+		memcpy(buf, line, len + 1);
 
 		notes_buf[count].id = id;
 		notes_buf[count].string = buf;
@@ -146,7 +147,9 @@ void mod_notes_destroy(struct mod_notes* notes) {
 
 const struct note* mod_notes_get(struct mod_notes* notes, unsigned* count) {
 	if(!notes->valid) {
+		uint64_t start = trace_begin();
 		reload(notes);
+		trace_end("notes reload", start);
 	}
 
 	*count = notes->notes_count;
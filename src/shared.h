@@ -9,6 +9,14 @@ struct pml;
 struct pml* dui_pml(void);
 void dui_exit(void);
 
+// Notifies status subscribers that the state of the given topics
+// (mask of enum status_topic, status.h) changed.
+void dui_status_changed(unsigned topics);
+
+// Notifies dui that a client subscribed to the given topics, so
+// that polled state (power) is refreshed again.
+void dui_status_subscribed(unsigned topics);
+
 struct inotify_event; // sys/inotify.h
 typedef void(*inotify_callback)(const struct inotify_event*, void* data);
 int add_inotify_watch(const char* pathname, uint32_t mask,
@@ -23,14 +31,101 @@ char* utf8_strlcpy(char* dst, const char* src, size_t maxncpy);
 // Returns the length of the utf-8 encoded character in bytes.
 unsigned utf8_length(const char* src);
 
+#define UTF8_REPLACEMENT 0xFFFDu // U+FFFD replacement character
+
+// Decodes the utf-8 character at src, which must be null-terminated.
+// Invalid sequences (including overlong encodings and surrogates) decode
+// to UTF8_REPLACEMENT with a length of one byte.
+// Sets len to the number of bytes consumed.
+uint32_t utf8_decode(const char* src, unsigned* len);
+
+// Encodes the given (valid) codepoint into dst, returns the length.
+unsigned utf8_encode(uint32_t cp, char dst[static 4]);
+
+// Returns whether the first len bytes of str are valid utf-8.
+// Uses simd (sse2/avx2) where available.
+bool utf8_validate(const char* str, size_t len);
+bool utf8_validate_scalar(const char* str, size_t len); // for benchmarks
+
+// Copies len bytes from src to dst (with size bytes), replacing invalid
+// sequences with U+FFFD. Cuts at a character boundary if dst is too
+// small. dst is always null-terminated (if size > 0).
+// Returns the number of bytes written, without null terminator.
+size_t utf8_sanitize(char* dst, size_t size, const char* src, size_t len);
+
+// Number of codepoints in the given valid utf-8 string.
+size_t utf8_count(const char* str, size_t len);
+
+// Approximate number of user-perceived characters (grapheme clusters),
+// i.e. codepoints without combining marks, variation selectors, emoji
+// modifiers and characters joined with a zero width joiner.
+size_t utf8_graphemes(const char* str, size_t len);
+
+enum dui_module {
+	dui_module_audio = (1u << 0),
+	dui_module_music = (1u << 1),
+	dui_module_notes = (1u << 2),
+	dui_module_brightness = (1u << 3),
+	dui_module_power = (1u << 4),
+};
+
+// Modules are created after the display, one per main loop iteration
+// (or on first use), so that the dashboard is responsive right away.
+// A module is published here once it's created; it stays NULL if
+// it's not available.
 struct modules {
 	struct mod_audio* audio;
 	struct mod_music* music;
 	struct mod_notes* notes;
 	struct mod_brightness* brightness;
 	struct mod_power* power;
+	unsigned loading; // mask of dui_module bits that aren't created yet
+};
+
+// Dispatch statistics of the main loop sources.
+// Callbacks registered with pml record their duration via
+// stats_record(source, start), where start was taken with stats_now()
+// when the callback was entered.
+enum stats_source {
+	stats_display, // wayland/x11 event source
+	stats_display_timer, // banner timer
+	stats_audio, // alsa source or pulse io events
+	stats_audio_timer, // pulse time events
+	stats_audio_defer, // pulse defer events
+	stats_music, // glib (playerctl) source or mpd connection
+	stats_inotify,
+	stats_control, // control socket connections
+	stats_commands, // execution of received commands
+	stats_ui_timer, // dashboard clock
+	stats_power_timer,
+	stats_module_init,
+	stats_source_count
 };
 
+void stats_init(void);
+void stats_finish(void);
+uint64_t stats_now(void); // monotonic, in nanoseconds
+void stats_record(enum stats_source, uint64_t start);
+void stats_iteration(void); // called once per main loop iteration
+void stats_startup_done(void); // called when all modules are created
+
+// Writes a human-readable report into buf.
+// Returns the number of bytes written, without null terminator.
+size_t stats_format(char* buf, size_t size);
+
+// Opt-in tracing of spans (e.g. frames, commands) into an in-memory
+// ring buffer that is written as chrome trace event json (viewable in
+// chrome://tracing or perfetto) on 'trace dump' and on exit.
+// Enabled by setting DUI_TRACE to the output path.
+// Names must be static strings.
+void trace_init(void);
+void trace_finish(void);
+bool trace_enabled(void);
+bool trace_dump(void);
+uint64_t trace_begin(void); // returns 0 if tracing is disabled
+void trace_end(const char* name, uint64_t start);
+void trace_instant(const char* name);
+
 // Should be used in dummy implementations of modules (except create an destroy).
 // Their create functions always return NULL and therefore calling a function
 // with a dummy modules is a programming error.
@@ -0,0 +1,176 @@
+#define _GNU_SOURCE
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include "shared.h"
+#include "state.h"
+#include "state_export.h"
+#include "status.h"
+#include "audio.h"
+#include "music.h"
+#include "brightness.h"
+#include "power.h"
+
+struct state_export {
+	const struct modules* modules;
+	int fd;
+	struct dui_state* map;
+	struct dui_state_data data; // the currently published data
+};
+
+// Copies the song description, cut at a character boundary.
+static void copy_song(char* dst, const char* song) {
+	size_t len = 0u;
+	while(*song != '\0') {
+		unsigned clen = utf8_length(song);
+		if(len + clen >= DUI_STATE_SONG_MAX || strnlen(song, clen) < clen) {
+			break;
+		}
+
+		memcpy(dst + len, song, clen);
+		len += clen;
+		song += clen;
+	}
+
+	memset(dst + len, 0, DUI_STATE_SONG_MAX - len);
+}
+
+static void publish(struct state_export* exp, const struct dui_state_data* data) {
+	struct dui_state* map = exp->map;
+	uint32_t seq = atomic_load_explicit(&map->seq, memory_order_relaxed);
+
+	// we are the only writer. Make the counter odd before touching the data
+	atomic_store_explicit(&map->seq, seq + 1, memory_order_relaxed);
+	atomic_thread_fence(memory_order_release);
+	memcpy(&map->data, data, sizeof(*data));
+	atomic_store_explicit(&map->seq, seq + 2, memory_order_release);
+
+	syscall(SYS_futex, (void*) &map->seq, FUTEX_WAKE, INT_MAX, NULL, NULL, 0);
+	exp->data = *data;
+}
+
+void state_export_update(struct state_export* exp, unsigned topics) {
+	const struct modules* mods = exp->modules;
+	struct dui_state_data data = exp->data;
+
+	if(topics & status_topic_audio) {
+		data.flags &= ~dui_state_audio;
+		if(mods->audio) {
+			data.flags |= dui_state_audio;
+			data.volume = mod_audio_get(mods->audio);
+			data.muted = mod_audio_get_muted(mods->audio);
+		}
+	}
+
+	if(topics & status_topic_music) {
+		data.flags &= ~dui_state_music;
+		if(mods->music) {
+			const char* song = mod_music_get_song(mods->music);
+			data.flags |= dui_state_music;
+			data.music_state = mod_music_get_state(mods->music);
+			copy_song(data.song, song ? song : "");
+		}
+	}
+
+	if(topics & status_topic_brightness) {
+		data.flags &= ~dui_state_brightness;
+		if(mods->brightness) {
+			data.flags |= dui_state_brightness;
+			data.brightness = mod_brightness_get(mods->brightness);
+		}
+	}
+
+	if(topics & status_topic_power) {
+		data.flags &= ~dui_state_power;
+		if(mods->power) {
+			struct mod_power_status status = mod_power_get(mods->power);
+			data.flags |= dui_state_power;
+			data.power_percent = status.percent;
+			data.power_charging = status.charging;
+			data.power_wattage = status.wattage;
+		}
+	}
+
+	// don't wake consumers up for nothing, e.g. for metadata changes
+	// that aren't part of the exported state
+	if(memcmp(&data, &exp->data, sizeof(data)) != 0) {
+		publish(exp, &data);
+	}
+}
+
+struct state_export* state_export_create(const struct modules* modules) {
+	char path[DUI_STATE_PATH_MAX];
+	if(!dui_state_path(path)) {
+		printf("state: XDG_RUNTIME_DIR not set, not exporting state\n");
+		return NULL;
+	}
+
+	// The file isn't recreated so that consumers can keep their
+	// mapping over restarts of dui. Since it is reused, make sure
+	// it's our own regular file and not a link planted by someone else.
+	int fd = open(path, O_RDWR | O_CREAT | O_CLOEXEC | O_NOFOLLOW, 0600);
+	if(fd < 0) {
+		printf("state: open %s failed: %s (%d)\n", path, strerror(errno), errno);
+		return NULL;
+	}
+
+	struct stat st;
+	if(fstat(fd, &st) != 0 || !S_ISREG(st.st_mode) || st.st_uid != getuid()) {
+		printf("state: %s is not a regular file owned by us\n", path);
+		close(fd);
+		return NULL;
+	}
+
+	// the state is private, files of older versions were readable by all
+	if((st.st_mode & 0777) != 0600 && fchmod(fd, 0600) != 0) {
+		printf("state: fchmod failed: %s (%d)\n", strerror(errno), errno);
+		close(fd);
+		return NULL;
+	}
+
+	if(ftruncate(fd, sizeof(struct dui_state)) != 0) {
+		printf("state: ftruncate failed: %s (%d)\n", strerror(errno), errno);
+		close(fd);
+		return NULL;
+	}
+
+	struct dui_state* map = mmap(NULL, sizeof(*map), PROT_READ | PROT_WRITE,
+		MAP_SHARED, fd, 0);
+	if(map == MAP_FAILED) {
+		printf("state: mmap failed: %s (%d)\n", strerror(errno), errno);
+		close(fd);
+		return NULL;
+	}
+
+	struct state_export* exp = calloc(1, sizeof(*exp));
+	exp->modules = modules;
+	exp->fd = fd;
+	exp->map = map;
+
+	// an odd counter left behind by a crash would block readers forever
+	uint32_t seq = atomic_load_explicit(&map->seq, memory_order_relaxed);
+	atomic_store_explicit(&map->seq, seq & ~1u, memory_order_relaxed);
+	map->magic = DUI_STATE_MAGIC;
+	map->version = DUI_STATE_VERSION;
+
+	exp->data.flags = dui_state_running;
+	publish(exp, &exp->data);
+	state_export_update(exp, status_topic_all);
+	return exp;
+}
+
+void state_export_destroy(struct state_export* exp) {
+	struct dui_state_data data = exp->data;
+	data.flags &= ~dui_state_running;
+	publish(exp, &data);
+
+	munmap(exp->map, sizeof(*exp->map));
+	close(exp->fd);
+	free(exp);
+}
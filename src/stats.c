@@ -0,0 +1,126 @@
+#define _POSIX_C_SOURCE 200809L
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+#include <pml.h>
+#include "shared.h"
+
+static const char* source_names[stats_source_count] = {
+	[stats_display] = "display",
+	[stats_display_timer] = "display timer",
+	[stats_audio] = "audio",
+	[stats_audio_timer] = "audio timer",
+	[stats_audio_defer] = "audio defer",
+	[stats_music] = "music",
+	[stats_inotify] = "inotify",
+	[stats_control] = "control",
+	[stats_commands] = "commands",
+	[stats_ui_timer] = "ui timer",
+	[stats_power_timer] = "power timer",
+	[stats_module_init] = "module init",
+};
+
+struct source_stats {
+	uint64_t count;
+	uint64_t total; // ns
+	uint64_t max; // ns
+};
+
+static struct {
+	uint64_t start; // time of stats_init
+	uint64_t startup; // duration until all modules were created, 0 if pending
+	uint64_t iterations; // main loop iterations
+	struct source_stats sources[stats_source_count];
+	struct pml_timer* log_timer;
+	unsigned log_interval; // seconds
+} ctx = {0};
+
+uint64_t stats_now(void) {
+	struct timespec ts;
+	clock_gettime(CLOCK_MONOTONIC, &ts);
+	return ts.tv_sec * 1000ull * 1000ull * 1000ull + ts.tv_nsec;
+}
+
+void stats_record(enum stats_source source, uint64_t start) {
+	uint64_t duration = stats_now() - start;
+	struct source_stats* stats = &ctx.sources[source];
+	++stats->count;
+	stats->total += duration;
+	if(duration > stats->max) {
+		stats->max = duration;
+	}
+}
+
+void stats_iteration(void) {
+	++ctx.iterations;
+}
+
+void stats_startup_done(void) {
+	ctx.startup = stats_now() - ctx.start;
+}
+
+size_t stats_format(char* buf, size_t size) {
+	size_t len = 0u;
+
+#define APPEND(...) do { \
+		if(len < size) { \
+			int ret = snprintf(buf + len, size - len, __VA_ARGS__); \
+			len += (ret > 0) ? (size_t) ret : 0u; \
+		} \
+	} while(0)
+
+	double uptime = (stats_now() - ctx.start) / (1000.0 * 1000.0 * 1000.0);
+	double minutes = uptime / 60.0;
+	APPEND("uptime=%.1fs startup=%.1fms wakeups=%llu (%.1f/min)\n", uptime,
+		ctx.startup / (1000.0 * 1000.0), (unsigned long long) ctx.iterations,
+		ctx.iterations / minutes);
+
+	for(unsigned i = 0u; i < stats_source_count; ++i) {
+		const struct source_stats* stats = &ctx.sources[i];
+		if(!stats->count) {
+			continue;
+		}
+
+		APPEND("%s: count=%llu (%.1f/min) total=%.2fms max=%.2fms\n",
+			source_names[i], (unsigned long long) stats->count,
+			stats->count / minutes, stats->total / (1000.0 * 1000.0),
+			stats->max / (1000.0 * 1000.0));
+	}
+
+#undef APPEND
+
+	return len < size ? len : (size ? size - 1 : 0u);
+}
+
+static void log_timer_cb(struct pml_timer* timer) {
+	char buf[2048];
+	stats_format(buf, sizeof(buf));
+	printf("stats:\n%s", buf);
+
+	struct timespec ts = { .tv_sec = ctx.log_interval };
+	pml_timer_set_time_rel(timer, ts);
+}
+
+void stats_init(void) {
+	ctx.start = stats_now();
+
+	// optional periodic log, every $DUI_STATS_INTERVAL seconds
+	const char* interval = getenv("DUI_STATS_INTERVAL");
+	if(interval && atoi(interval) > 0) {
+		ctx.log_interval = atoi(interval);
+		ctx.log_timer = pml_timer_new(dui_pml(), NULL, log_timer_cb);
+		pml_timer_set_clock(ctx.log_timer, CLOCK_MONOTONIC);
+
+		struct timespec ts = { .tv_sec = ctx.log_interval };
+		pml_timer_set_time_rel(ctx.log_timer, ts);
+	}
+}
+
+void stats_finish(void) {
+	if(ctx.log_timer) {
+		pml_timer_destroy(ctx.log_timer);
+		ctx.log_timer = NULL;
+	}
+}
@@ -0,0 +1,118 @@
+#define _POSIX_C_SOURCE 200809L
+
+#include <stdio.h>
+#include <string.h>
+#include "shared.h"
+#include "status.h"
+#include "audio.h"
+#include "music.h"
+#include "brightness.h"
+#include "power.h"
+
+// Maximum number of bytes of the song description, so that the music
+// topic stays below STATUS_TOPIC_MAX.
+#define SONG_MAX 192u
+
+static const struct {
+	const char* name;
+	unsigned topic;
+} topic_names[] = {
+	{"audio", status_topic_audio},
+	{"music", status_topic_music},
+	{"brightness", status_topic_brightness},
+	{"power", status_topic_power},
+	{"all", status_topic_all},
+};
+
+unsigned status_parse_topics(const char* list) {
+	unsigned topics = 0u;
+	while(*list != '\0') {
+		size_t len = strcspn(list, " ");
+		unsigned found = 0u;
+		for(unsigned i = 0u; i < sizeof(topic_names) / sizeof(topic_names[0]); ++i) {
+			if(strncmp(topic_names[i].name, list, len) == 0 &&
+					topic_names[i].name[len] == '\0') {
+				found = topic_names[i].topic;
+				break;
+			}
+		}
+
+		if(!found) {
+			return 0u;
+		}
+
+		topics |= found;
+		list += len;
+		list += strspn(list, " ");
+	}
+
+	return topics;
+}
+
+static const char* state_name(enum music_state state) {
+	switch(state) {
+		case music_state_stopped: return "stopped";
+		case music_state_playing: return "playing";
+		case music_state_paused: return "paused";
+		default: return "none";
+	}
+}
+
+// Copies the song description, without line breaks (they would
+// break the line-based format) and cut at a character boundary.
+static void copy_song(char* dst, const char* song) {
+	size_t len = 0u;
+	while(*song != '\0') {
+		unsigned clen = utf8_length(song);
+		if(len + clen >= SONG_MAX || strnlen(song, clen) < clen) {
+			break;
+		}
+
+		for(unsigned i = 0u; i < clen; ++i, ++song) {
+			dst[len++] = (*song == '\n' || *song == '\r') ? ' ' : *song;
+		}
+	}
+
+	dst[len] = '\0';
+}
+
+size_t status_format(const struct modules* modules, unsigned topics,
+		char* buf, size_t size) {
+	size_t len = 0u;
+
+#define APPEND(...) do { \
+		if(len < size) { \
+			int ret = snprintf(buf + len, size - len, __VA_ARGS__); \
+			len += (ret > 0) ? (size_t) ret : 0u; \
+		} \
+	} while(0)
+
+	if((topics & status_topic_audio) && modules->audio) {
+		APPEND("audio.volume=%u\naudio.muted=%d\n",
+			mod_audio_get(modules->audio),
+			(int) mod_audio_get_muted(modules->audio));
+	}
+
+	if((topics & status_topic_music) && modules->music) {
+		const char* song = mod_music_get_song(modules->music);
+		char songbuf[SONG_MAX];
+		copy_song(songbuf, song ? song : "");
+		APPEND("music.state=%s\nmusic.song=%s\n",
+			state_name(mod_music_get_state(modules->music)), songbuf);
+	}
+
+	if((topics & status_topic_brightness) && modules->brightness) {
+		APPEND("brightness.percent=%d\n",
+			mod_brightness_get(modules->brightness));
+	}
+
+	if((topics & status_topic_power) && modules->power) {
+		struct mod_power_status status = mod_power_get(modules->power);
+		APPEND("power.percent=%u\npower.charging=%d\npower.wattage=%.2f\n",
+			status.percent, (int) status.charging, status.wattage);
+	}
+
+#undef APPEND
+
+	return len < size ? len : (size ? size - 1 : 0u);
+}
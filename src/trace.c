@@ -0,0 +1,137 @@
+#define _POSIX_C_SOURCE 200809L
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <errno.h>
+#include <unistd.h>
+#include <stdatomic.h>
+#include "shared.h"
+
+// Number of events kept in memory, must be a power of two.
+// Older events are overwritten.
+#define TRACE_SIZE 16384u
+_Static_assert((TRACE_SIZE & (TRACE_SIZE - 1)) == 0, "TRACE_SIZE must be pow2");
+
+#define TRACE_INSTANT UINT64_MAX
+
+struct trace_event {
+	const char* name;
+	uint64_t start; // ns
+	uint64_t duration; // ns, TRACE_INSTANT for instant events
+};
+
+static struct {
+	char* path; // NULL if tracing is disabled
+	struct trace_event* events;
+	// Total number of recorded events. Writers reserve their slot
+	// with an atomic increment, so no lock is needed.
+	_Atomic uint64_t head;
+} ctx = {0};
+
+static void record(const char* name, uint64_t start, uint64_t duration) {
+	uint64_t id = atomic_fetch_add_explicit(&ctx.head, 1, memory_order_relaxed);
+	struct trace_event* ev = &ctx.events[id & (TRACE_SIZE - 1)];
+	ev->name = name;
+	ev->start = start;
+	ev->duration = duration;
+}
+
+uint64_t trace_begin(void) {
+	return ctx.events ? stats_now() : 0u;
+}
+
+void trace_end(const char* name, uint64_t start) {
+	if(start) {
+		record(name, start, stats_now() - start);
+	}
+}
+
+void trace_instant(const char* name) {
+	if(ctx.events) {
+		record(name, stats_now(), TRACE_INSTANT);
+	}
+}
+
+bool trace_enabled(void) {
+	return ctx.events;
+}
+
+// Writes str as json string literal.
+static void write_string(FILE* f, const char* str) {
+	fputc('"', f);
+	for(; *str != '\0'; ++str) {
+		if(*str == '"' || *str == '\\') {
+			fputc('\\', f);
+		}
+		fputc((unsigned char) *str < 0x20 ? ' ' : *str, f);
+	}
+	fputc('"', f);
+}
+
+bool trace_dump(void) {
+	if(!ctx.events) {
+		return false;
+	}
+
+	FILE* f = fopen(ctx.path, "w");
+	if(!f) {
+		printf("trace: can't open %s: %s (%d)\n", ctx.path,
+			strerror(errno), errno);
+		return false;
+	}
+
+	// events recorded while dumping (there are none on the main
+	// thread) may end up partially written.
+	uint64_t head = atomic_load_explicit(&ctx.head, memory_order_acquire);
+	uint64_t first = head > TRACE_SIZE ? head - TRACE_SIZE : 0u;
+	int pid = getpid();
+
+	fprintf(f, "{\"displayTimeUnit\":\"ms\",\"traceEvents\":[\n");
+	for(uint64_t i = first; i < head; ++i) {
+		const struct trace_event* ev = &ctx.events[i & (TRACE_SIZE - 1)];
+		fprintf(f, "%s{\"name\":", i == first ? "" : ",\n");
+		write_string(f, ev->name);
+		if(ev->duration == TRACE_INSTANT) {
+			fprintf(f, ",\"ph\":\"i\",\"s\":\"p\",\"ts\":%.3f",
+				ev->start / 1000.0);
+		} else {
+			fprintf(f, ",\"ph\":\"X\",\"ts\":%.3f,\"dur\":%.3f",
+				ev->start / 1000.0, ev->duration / 1000.0);
+		}
+		fprintf(f, ",\"pid\":%d,\"tid\":%d}", pid, pid);
+	}
+	fprintf(f, "\n]}\n");
+
+	bool ok = !ferror(f);
+	if(fclose(f) != 0 || !ok) {
+		printf("trace: writing %s failed\n", ctx.path);
+		return false;
+	}
+
+	printf("trace: wrote %llu events to %s\n",
+		(unsigned long long) (head - first), ctx.path);
+	return true;
+}
+
+void trace_init(void) {
+	const char* path = getenv("DUI_TRACE");
+	if(!path || path[0] == '\0') {
+		return;
+	}
+
+	ctx.path = strdup(path);
+	ctx.events = calloc(TRACE_SIZE, sizeof(*ctx.events));
+	printf("trace: enabled, writing to %s\n", ctx.path);
+}
+
+void trace_finish(void) {
+	if(ctx.events) {
+		trace_dump();
+	}
+
+	free(ctx.events);
+	free(ctx.path);
+	ctx.events = NULL;
+	ctx.path = NULL;
+}
@@ -4,10 +4,10 @@
 #include <stdlib.h>
 #include <stdbool.h>
 #include <string.h>
-#include <assert.h>
 #include <time.h>
 #include <errno.h>
 #include <unistd.h>
+#include <math.h>
 #include <cairo/cairo.h>
 #include <linux/input-event-codes.h>
 #include <pml.h>
@@ -29,6 +29,96 @@
 // dashboard immediately when the system time is changed.
 // Not a huge deal for now i guess.
 
+// Maximum number of visible notes.
+#define MAX_NOTE_ROWS 16u
+
+#define FONT_TEXT "DejaVu Sans"
+#define FONT_SYMBOL "FontAwesome"
+#define MAX_FONTS 32u
+#define ADVANCE_CACHE_SIZE 512u // per font, must be a power of two
+#define ELLIPSIZE_MAX 512u // characters measured by ellipsize
+#define ELLIPSIS 0x2026u // …
+#define ATLAS_MAX_GLYPHS 24u
+#define ATLAS_PADDING 1 // pixels between glyphs in the atlas
+
+// The characters that make up the frequently changing readouts
+// (clock, percentages, wattage) and the status symbols
+#define ATLAS_CLOCK "0123456789:"
+#define ATLAS_READOUT "0123456789%:. W"
+#define ATLAS_SYMBOLS u8""
+
+// Cached font. Selecting toy font faces by name means fontconfig
+// matching and face lookup on every call, so the scaled fonts used by
+// the ui are resolved once and looked up here.
+// Fonts are rasterized for a device scale, there is one per scale.
+struct font {
+	const char* family;
+	cairo_font_weight_t weight;
+	double size;
+	double scale;
+	cairo_scaled_font_t* scaled;
+	struct advance* advances; // ADVANCE_CACHE_SIZE, created on first use
+	const char* charset; // characters pre-rasterized into the atlas
+	struct atlas* atlas; // NULL if there is no charset
+};
+
+// Cached horizontal advance of a glyph
+struct advance {
+	uint32_t key; // codepoint + 1, 0 for empty slots
+	float advance;
+};
+
+// Pre-rasterized glyph, part of an atlas
+struct glyph {
+	uint32_t cp;
+	cairo_surface_t* mask; // NULL for empty glyphs (e.g. space)
+	int x, y; // offset of the mask to the pen position, in pixels
+	int width, height; // in pixels
+	double advance;
+};
+
+// Glyphs of a font that are drawn over and over, rasterized once into
+// an A8 surface. Drawing them is a cairo_mask_surface per glyph instead
+// of shaping and looking up glyphs in cairo's text path every time.
+struct atlas {
+	cairo_surface_t* surface;
+	unsigned count;
+	struct glyph glyphs[ATLAS_MAX_GLYPHS];
+};
+
+// The fonts the ui uses, created in ui_create for scale 1.
+// Other scales are created when first drawn with.
+static const struct font default_fonts[] = {
+	{FONT_TEXT, CAIRO_FONT_WEIGHT_BOLD, 60.0, 1.0, NULL, NULL, ATLAS_CLOCK, NULL},
+	{FONT_TEXT, CAIRO_FONT_WEIGHT_BOLD, 16.0, 1.0, NULL, NULL, NULL, NULL}, // date
+	{FONT_TEXT, CAIRO_FONT_WEIGHT_NORMAL, 18.0, 1.0, NULL, NULL, ATLAS_READOUT, NULL},
+	{FONT_SYMBOL, CAIRO_FONT_WEIGHT_NORMAL, 18.0, 1.0, NULL, NULL, ATLAS_SYMBOLS, NULL},
+	{FONT_SYMBOL, CAIRO_FONT_WEIGHT_NORMAL, 30.0, 1.0, NULL, NULL, ATLAS_SYMBOLS, NULL}, // banner
+};
+
+enum widget_id {
+	widget_clock,
+	widget_date,
+	widget_music,
+	widget_audio,
+	widget_brightness,
+	widget_power,
+	widget_note_first, // one widget per visible note row
+	widget_count = widget_note_first + MAX_NOTE_ROWS,
+};
+
+_Static_assert(widget_count <= UI_MAX_DAMAGE, "UI_MAX_DAMAGE too small");
+
+struct widget {
+	struct ui_rect rect;
+	int baseline; // relative to rect.y
+	// Hash of the displayed state. When it changes, the widget gets the
+	// new ui stamp as version and is rendered again by all frames whose
+	// surface contents are older than that.
+	uint64_t key;
+	uint64_t version;
+};
+
 struct ui {
 	struct modules* modules;
 	unsigned notes_count;
@@ -36,8 +126,325 @@ struct ui {
 	unsigned active_note;
 	struct pml_timer* timer;
 	struct display* display;
+
+	struct tm now; // time of the current dashboard frame
+	uint64_t stamp; // incremented on every change of the dashboard
+	uint64_t layout_stamp; // stamp of the last layout change
+	unsigned width, height; // size of the current layout
+	int separators[2]; // y coordinates of the separator lines
+	unsigned note_rows;
+	struct widget widgets[widget_count];
+
+	unsigned font_count;
+	struct font fonts[MAX_FONTS];
+	uint64_t font_hits, font_misses;
 };
 
+static cairo_scaled_font_t* create_font(const char* family,
+		cairo_font_weight_t weight, double size, double scale) {
+	cairo_font_face_t* face = cairo_toy_font_face_create(family,
+		CAIRO_FONT_SLANT_NORMAL, weight);
+	cairo_matrix_t matrix, ctm;
+	cairo_matrix_init_scale(&matrix, size, size);
+	cairo_matrix_init_scale(&ctm, scale, scale);
+	cairo_font_options_t* options = cairo_font_options_create();
+
+	cairo_scaled_font_t* font = cairo_scaled_font_create(face, &matrix,
+		&ctm, options);
+	cairo_font_options_destroy(options);
+	cairo_font_face_destroy(face); // referenced by the scaled font
+
+	cairo_status_t status = cairo_scaled_font_status(font);
+	if(status != CAIRO_STATUS_SUCCESS) {
+		printf("ui: can't create font '%s' %.0f: %s\n", family, size,
+			cairo_status_to_string(status));
+	}
+
+	return font;
+}
+
+static struct atlas* create_atlas(cairo_scaled_font_t* scaled,
+	const char* charset, double scale);
+
+// Returns the cached font, creating it on a miss.
+// Returns NULL if the cache is full.
+static struct font* get_font(struct ui* ui, const char* family,
+		cairo_font_weight_t weight, double size, double scale) {
+	for(unsigned i = 0u; i < ui->font_count; ++i) {
+		struct font* font = &ui->fonts[i];
+		if(font->weight == weight && font->size == size &&
+				font->scale == scale && strcmp(font->family, family) == 0) {
+			++ui->font_hits;
+			return font;
+		}
+	}
+
+	++ui->font_misses;
+	if(ui->font_count == MAX_FONTS) {
+		return NULL;
+	}
+
+	struct font* font = &ui->fonts[ui->font_count++];
+	font->family = family;
+	font->weight = weight;
+	font->size = size;
+	font->scale = scale;
+	font->scaled = create_font(family, weight, size, scale);
+	font->advances = NULL;
+	font->charset = NULL;
+	font->atlas = NULL;
+
+	// the readouts of the default fonts are drawn from an atlas
+	unsigned count = sizeof(default_fonts) / sizeof(default_fonts[0]);
+	for(unsigned i = 0u; i < count; ++i) {
+		const struct font* def = &default_fonts[i];
+		if(def->charset && def->weight == weight && def->size == size &&
+				strcmp(def->family, family) == 0) {
+			font->charset = def->charset;
+			font->atlas = create_atlas(font->scaled, def->charset, scale);
+			break;
+		}
+	}
+
+	return font;
+}
+
+// Glyph boxes are in device pixels, advances in user space.
+static struct atlas* create_atlas(cairo_scaled_font_t* scaled,
+		const char* charset, double scale) {
+	struct atlas* atlas = calloc(1, sizeof(*atlas));
+	int width = 0, height = 0;
+	while(*charset != '\0' && atlas->count < ATLAS_MAX_GLYPHS) {
+		unsigned len;
+		uint32_t cp = utf8_decode(charset, &len);
+		char str[5];
+		str[utf8_encode(cp, str)] = '\0';
+		charset += len;
+
+		cairo_text_extents_t extents;
+		cairo_scaled_font_text_extents(scaled, str, &extents);
+		struct glyph* g = &atlas->glyphs[atlas->count++];
+		g->cp = cp;
+		g->advance = extents.x_advance;
+		g->x = floor(scale * extents.x_bearing);
+		g->y = floor(scale * extents.y_bearing);
+		g->width = ceil(scale * (extents.x_bearing + extents.width)) - g->x;
+		g->height = ceil(scale * (extents.y_bearing + extents.height)) - g->y;
+		width += g->width + ATLAS_PADDING;
+		height = g->height > height ? g->height : height;
+	}
+
+	if(!width || !height) {
+		return atlas;
+	}
+
+	// all glyphs in one row, each one gets a subsurface as mask
+	atlas->surface = cairo_image_surface_create(CAIRO_FORMAT_A8,
+		width, height);
+	cairo_t* cr = cairo_create(atlas->surface);
+	cairo_scale(cr, scale, scale); // matches the ctm of the font
+	cairo_set_scaled_font(cr, scaled);
+	int x = 0;
+	for(unsigned i = 0u; i < atlas->count; ++i) {
+		struct glyph* g = &atlas->glyphs[i];
+		if(!g->width || !g->height) {
+			continue;
+		}
+
+		char str[5];
+		str[utf8_encode(g->cp, str)] = '\0';
+		cairo_move_to(cr, (x - g->x) / scale, -g->y / scale);
+		cairo_show_text(cr, str);
+		g->mask = cairo_surface_create_for_rectangle(atlas->surface,
+			x, 0, g->width, g->height);
+		cairo_surface_set_device_scale(g->mask, scale, scale);
+		x += g->width + ATLAS_PADDING;
+	}
+
+	cairo_destroy(cr);
+	cairo_surface_flush(atlas->surface);
+	return atlas;
+}
+
+static void destroy_atlas(struct atlas* atlas) {
+	if(!atlas) {
+		return;
+	}
+
+	for(unsigned i = 0u; i < atlas->count; ++i) {
+		if(atlas->glyphs[i].mask) {
+			cairo_surface_destroy(atlas->glyphs[i].mask);
+		}
+	}
+	if(atlas->surface) {
+		cairo_surface_destroy(atlas->surface);
+	}
+	free(atlas);
+}
+
+static const struct glyph* atlas_glyph(const struct atlas* atlas,
+		uint32_t cp) {
+	for(unsigned i = 0u; i < atlas->count; ++i) {
+		if(atlas->glyphs[i].cp == cp) {
+			return &atlas->glyphs[i];
+		}
+	}
+	return NULL;
+}
+
+// Draws text at (x, y) with the current font of cr (font, as returned by
+// set_font, may be NULL). Uses the atlas if it has all characters of text,
+// cairo_show_text otherwise. Like cairo_show_text, leaves the current
+// point after the text.
+static void draw_text(cairo_t* cr, struct font* font, double x, double y,
+		const char* text) {
+	const struct glyph* glyphs[32];
+	unsigned count = 0u;
+	bool atlas = font && font->atlas;
+	for(const char* it = text; atlas && *it != '\0';) {
+		unsigned len;
+		uint32_t cp = utf8_decode(it, &len);
+		it += len;
+		if(count == sizeof(glyphs) / sizeof(glyphs[0]) ||
+				!(glyphs[count++] = atlas_glyph(font->atlas, cp))) {
+			atlas = false;
+		}
+	}
+
+	if(!atlas) {
+		cairo_move_to(cr, x, y);
+		cairo_show_text(cr, text);
+		return;
+	}
+
+	// glyphs are rasterized at integer device positions, like cairo
+	// does for image surfaces
+	double scale = font->scale;
+	double py = floor(scale * y + 0.5);
+	for(unsigned i = 0u; i < count; ++i) {
+		const struct glyph* g = glyphs[i];
+		if(g->mask) {
+			double px = floor(scale * x + 0.5);
+			cairo_mask_surface(cr, g->mask,
+				(px + g->x) / scale, (py + g->y) / scale);
+		}
+		x += g->advance;
+	}
+
+	cairo_move_to(cr, x, y);
+}
+
+// The transformation matrix of cr must be the identity, the font is
+// chosen for the device scale of its target.
+// Returns the font, NULL if it isn't cached.
+static struct font* set_font(struct ui* ui, cairo_t* cr, const char* family,
+		cairo_font_weight_t weight, double size) {
+	double sx, sy;
+	cairo_surface_get_device_scale(cairo_get_target(cr), &sx, &sy);
+	struct font* font = get_font(ui, family, weight, size, sx);
+	if(font) {
+		cairo_set_scaled_font(cr, font->scaled);
+	} else {
+		cairo_select_font_face(cr, family, CAIRO_FONT_SLANT_NORMAL, weight);
+		cairo_set_font_size(cr, size);
+	}
+
+	return font;
+}
+
+// Returns the advance of the codepoint in the current font of cr.
+// font is the current font (may be NULL, then nothing is cached).
+static double get_advance(cairo_t* cr, struct font* font, uint32_t cp) {
+	struct advance* slot = NULL;
+	if(font) {
+		if(!font->advances) {
+			font->advances = calloc(ADVANCE_CACHE_SIZE, sizeof(*font->advances));
+		}
+
+		// open addressing, linear probing. When full, just don't cache
+		for(unsigned i = 0u; i < ADVANCE_CACHE_SIZE; ++i) {
+			struct advance* a = &font->advances[(cp + i) & (ADVANCE_CACHE_SIZE - 1)];
+			if(a->key == cp + 1) {
+				return a->advance;
+			} else if(!a->key) {
+				slot = a;
+				break;
+			}
+		}
+	}
+
+	char str[5];
+	str[utf8_encode(cp, str)] = '\0';
+	cairo_text_extents_t extents;
+	cairo_scaled_font_text_extents(cairo_get_scaled_font(cr), str, &extents);
+	if(slot) {
+		slot->key = cp + 1;
+		slot->advance = extents.x_advance;
+	}
+
+	return extents.x_advance;
+}
+
+// Writes text into buf so that it fits into max_width with the current
+// font of cr (font, as returned by set_font), shortened with an ellipsis
+// if needed. Invalid utf-8 is replaced, so the result can always be
+// passed to cairo. Returns the width of the result.
+static double ellipsize(cairo_t* cr, struct font* font, const char* text,
+		double max_width, char* buf, size_t size) {
+	// widths[i]: width of the first i characters, ends[i]: their byte length
+	double widths[ELLIPSIZE_MAX + 1];
+	size_t ends[ELLIPSIZE_MAX + 1];
+	char ellipsis[4];
+	unsigned ellipsis_len = utf8_encode(ELLIPSIS, ellipsis);
+	unsigned count = 0u;
+	assert(size > ellipsis_len);
+	size_t len = 0u;
+
+	// copy (sanitized) as much as fits into buf, measure it on the way
+	widths[0] = 0.0;
+	ends[0] = 0u;
+	bool truncated = false;
+	while(*text != '\0') {
+		unsigned clen;
+		uint32_t cp = utf8_decode(text, &clen);
+		char enc[4];
+		unsigned elen = utf8_encode(cp, enc);
+		if(count == ELLIPSIZE_MAX || len + elen + ellipsis_len >= size) {
+			truncated = true;
+			break;
+		}
+
+		memcpy(buf + len, enc, elen);
+		len += elen;
+		text += clen;
+		++count;
+		widths[count] = widths[count - 1] + get_advance(cr, font, cp);
+		ends[count] = len;
+	}
+
+	if(!truncated && widths[count] <= max_width) {
+		buf[len] = '\0';
+		return widths[count];
+	}
+
+	// find the longest prefix that fits with the ellipsis
+	double ellipsis_width = get_advance(cr, font, ELLIPSIS);
+	double available = max_width - ellipsis_width;
+	unsigned lo = 0u, hi = count;
+	while(lo < hi) {
+		unsigned mid = (lo + hi + 1) / 2;
+		if(widths[mid] <= available) {
+			lo = mid;
+		} else {
+			hi = mid - 1;
+		}
+	}
+
+	memcpy(buf + ends[lo], ellipsis, ellipsis_len);
+	buf[ends[lo] + ellipsis_len] = '\0';
+	return widths[lo] + ellipsis_width;
+}
+
 static const char* music_state_symbol(int state) {
 	switch(state) {
 		case 1: return u8"";
@@ -73,191 +480,435 @@ static const char* banner_symbol(enum banner banner, struct modules* modules) {
 	}
 }
 
-static void draw_dashboard(struct ui* ui, cairo_t* cr,
-		unsigned width, unsigned height) {
-	struct modules* modules = ui->modules;
+// Dashboard layout, in pixels.
+// The dashboard is a column of rows (clock, date, music, the status row
+// and the notes list) separated by margins. Each row consists of widget
+// boxes, text is drawn at a baseline relative to the box.
+#define LAYOUT_MARGIN 32 // left and right
+#define LAYOUT_TOP 20
+#define LAYOUT_BOTTOM 10
+#define LAYOUT_ROW_SPACING 10
+#define LAYOUT_SEPARATOR_SPACING 20 // above and below separator lines
+#define LAYOUT_STATUS_WIDTH 120 // audio, brightness
+#define LAYOUT_SYMBOL_WIDTH 28 // space reserved for symbols before text
+#define LAYOUT_NOTE_HEIGHT 35
+#define LAYOUT_NOTE_PADDING 12 // highlight space left of a note
+
+#define HASH_INIT 14695981039346656037ull
+
+typedef uint64_t (*widget_fn)(struct ui*, const struct widget*, cairo_t*);
+
+// FNV-1a
+static uint64_t hash(uint64_t h, const void* data, size_t size) {
+	const unsigned char* bytes = data;
+	for(size_t i = 0u; i < size; ++i) {
+		h = (h ^ bytes[i]) * 1099511628211ull;
+	}
+	return h;
+}
+
+static uint64_t hash_str(uint64_t h, const char* str) {
+	return hash(h, str, strlen(str) + 1);
+}
+
+static void place(struct widget* w, int x, int y, int width, int height,
+		int baseline) {
+	w->rect = (struct ui_rect) {x, y, width, height};
+	w->baseline = baseline;
+}
+
+static void layout(struct ui* ui, unsigned width, unsigned height) {
+	int full = width - 2 * LAYOUT_MARGIN;
+	int x = LAYOUT_MARGIN;
+	int y = LAYOUT_TOP;
+
+	place(&ui->widgets[widget_clock], x, y, full, 70, 60);
+	y += 70;
+	place(&ui->widgets[widget_date], x, y, full, 30, 15);
+	y += 30 + LAYOUT_SEPARATOR_SPACING;
+
+	ui->separators[0] = y;
+	y += LAYOUT_SEPARATOR_SPACING;
+
+	place(&ui->widgets[widget_music], x, y, full, 30, 20);
+	y += 30 + LAYOUT_ROW_SPACING;
+
+	place(&ui->widgets[widget_audio], x, y, LAYOUT_STATUS_WIDTH, 30, 20);
+	x += LAYOUT_STATUS_WIDTH;
+	place(&ui->widgets[widget_brightness], x, y, LAYOUT_STATUS_WIDTH, 30, 20);
+	x += LAYOUT_STATUS_WIDTH;
+	place(&ui->widgets[widget_power], x, y, width - LAYOUT_MARGIN - x, 30, 20);
+	y += 30 + LAYOUT_SEPARATOR_SPACING;
+
+	ui->separators[1] = y;
+	y += LAYOUT_SEPARATOR_SPACING;
+
+	// as many note rows as fit
+	ui->note_rows = 0u;
+	x = LAYOUT_MARGIN - LAYOUT_NOTE_PADDING;
+	while(ui->note_rows < MAX_NOTE_ROWS &&
+			y + LAYOUT_NOTE_HEIGHT + LAYOUT_BOTTOM <= (int) height) {
+		struct widget* w = &ui->widgets[widget_note_first + ui->note_rows];
+		place(w, x, y, width - 2 * x, LAYOUT_NOTE_HEIGHT, 30);
+		y += LAYOUT_NOTE_HEIGHT;
+		++ui->note_rows;
+	}
+}
+
+static void show_text(struct ui* ui, cairo_t* cr, bool symbol,
+		double x, double y, const char* text) {
+	struct font* font = set_font(ui, cr, symbol ? FONT_SYMBOL : FONT_TEXT,
+		CAIRO_FONT_WEIGHT_NORMAL, 18.0);
+	draw_text(cr, font, x, y, text);
+}
+
+// Placeholder for modules that are still being created.
+static uint64_t placeholder(struct ui* ui, const struct widget* w,
+		cairo_t* cr, enum dui_module module) {
+	if(!(ui->modules->loading & module)) {
+		return HASH_INIT;
+	}
+
+	if(cr) {
+		cairo_set_source_rgba(cr, 0.6, 0.6, 0.6, 0.6);
+		show_text(ui, cr, false, w->rect.x, w->rect.y + w->baseline, u8"…");
+	}
+
+	return hash_str(HASH_INIT, "loading");
+}
+
+// Widget functions return the key of the current state.
+// When a cairo context is given, they also render it.
+static uint64_t clock_widget(struct ui* ui, const struct widget* w,
+		cairo_t* cr) {
+	char buf[64];
+	strftime(buf, sizeof(buf), "%H:%M", &ui->now);
+	if(cr) {
+		struct font* font = set_font(ui, cr, FONT_TEXT,
+			CAIRO_FONT_WEIGHT_BOLD, 60.0);
+		cairo_set_source_rgb(cr, 0.9, 0.9, 0.9);
+		draw_text(cr, font, w->rect.x, w->rect.y + w->baseline, buf);
+	}
+
+	return hash_str(HASH_INIT, buf);
+}
+
+static uint64_t date_widget(struct ui* ui, const struct widget* w,
+		cairo_t* cr) {
 	char buf[256];
-	const char* sym;
+	strftime(buf, sizeof(buf), "%A, %d. %B %y", &ui->now);
+	if(cr) {
+		set_font(ui, cr, FONT_TEXT, CAIRO_FONT_WEIGHT_BOLD, 16.0);
+		cairo_set_source_rgba(cr, 0.8, 0.8, 0.8, 0.8);
+		cairo_move_to(cr, w->rect.x, w->rect.y + w->baseline);
+		cairo_show_text(cr, buf);
+	}
 
-	// background
-	cairo_set_source_rgba(cr, 0.1, 0.1, 0.1, 0.6);
-	cairo_set_operator(cr, CAIRO_OPERATOR_SOURCE);
-	cairo_paint(cr);
+	return hash_str(HASH_INIT, buf);
+}
 
-	cairo_set_operator(cr, CAIRO_OPERATOR_OVER);
+static uint64_t music_widget(struct ui* ui, const struct widget* w,
+		cairo_t* cr) {
+	struct modules* modules = ui->modules;
+	if(!modules->music) {
+		return placeholder(ui, w, cr, dui_module_music);
+	}
 
-	// date & time
-	time_t t = time(NULL);
-	struct tm tm_info;
-	assert(localtime_r(&t, &tm_info));
+	enum music_state musicstate = mod_music_get_state(modules->music);
+	const char* song = mod_music_get_song(modules->music);
+	const char* sym = music_state_symbol(musicstate);
+	if(!song || musicstate == 1) {
+		song = "-";
+	}
 
-	strftime(buf, sizeof(buf), "%H:%M", &tm_info);
-	cairo_select_font_face(cr, "DejaVu Sans",
-		CAIRO_FONT_SLANT_NORMAL, CAIRO_FONT_WEIGHT_BOLD);
-	cairo_set_font_size(cr, 60.0);
-	cairo_set_source_rgb(cr, 0.9, 0.9, 0.9);
-	cairo_move_to(cr, 32.0, 80.0);
-	cairo_show_text(cr, buf);
+	if(cr) {
+		double x = w->rect.x + LAYOUT_SYMBOL_WIDTH;
+		double y = w->rect.y + w->baseline;
+		cairo_set_source_rgba(cr, 0.8, 0.8, 0.8, 0.8);
+		show_text(ui, cr, true, w->rect.x, y, sym);
 
-	strftime(buf, sizeof(buf), "%A, %d. %B %y", &tm_info);
-	cairo_set_font_size(cr, 16.0);
-	cairo_set_source_rgba(cr, 0.8, 0.8, 0.8, 0.8);
-	cairo_move_to(cr, 32.0, 105.0);
-	cairo_show_text(cr, buf);
+		char buf[512];
+		struct font* font = set_font(ui, cr, FONT_TEXT,
+			CAIRO_FONT_WEIGHT_NORMAL, 18.0);
+		ellipsize(cr, font, song, w->rect.x + w->rect.width - x,
+			buf, sizeof(buf));
+		cairo_move_to(cr, x, y);
+		cairo_show_text(cr, buf);
+	}
 
-	// set timer to redraw dashboard when next minute happens
-	int seconds = 60 - tm_info.tm_sec;
-	struct timespec ts = { .tv_sec = seconds };
-	pml_timer_set_time_rel(ui->timer, ts);
+	return hash_str(hash_str(HASH_INIT, sym), song);
+}
 
-	// small line
-	cairo_move_to(cr, 220, 140);
-	cairo_line_to(cr, width - 220, 140);
-	cairo_set_line_width(cr, 0.4);
-	cairo_stroke(cr);
+static uint64_t audio_widget(struct ui* ui, const struct widget* w,
+		cairo_t* cr) {
+	struct modules* modules = ui->modules;
+	if(!modules->audio) {
+		return placeholder(ui, w, cr, dui_module_audio);
+	}
 
-	// music
-	if(modules->music) {
-		cairo_set_font_size(cr, 18.0);
-		cairo_select_font_face(cr, "FontAwesome",
-			CAIRO_FONT_SLANT_NORMAL, CAIRO_FONT_WEIGHT_NORMAL);
+	char buf[32];
+	const char* sym;
+	if(mod_audio_get_muted(modules->audio)) {
+		snprintf(buf, sizeof(buf), "MUTE");
+		sym = u8"";
+	} else {
+		unsigned vol = mod_audio_get(modules->audio);
+		snprintf(buf, sizeof(buf), "%d%%", vol);
+		sym = u8"";
+	}
 
-		enum music_state musicstate = mod_music_get_state(modules->music);
-		const char* song = mod_music_get_song(modules->music);
+	if(cr) {
+		double y = w->rect.y + w->baseline;
+		cairo_set_source_rgba(cr, 0.8, 0.8, 0.8, 0.8);
+		show_text(ui, cr, true, w->rect.x, y, sym);
+		show_text(ui, cr, false, w->rect.x + LAYOUT_SYMBOL_WIDTH, y, buf);
+	}
 
-		sym = music_state_symbol(musicstate);
-		if(!song || musicstate == 1) {
-			song = "-";
-		}
+	return hash_str(hash_str(HASH_INIT, sym), buf);
+}
 
+static uint64_t brightness_widget(struct ui* ui, const struct widget* w,
+		cairo_t* cr) {
+	struct modules* modules = ui->modules;
+	if(!modules->brightness) {
+		return placeholder(ui, w, cr, dui_module_brightness);
+	}
+
+	int brightness = mod_brightness_get(modules->brightness);
+	if(brightness < 0) {
+		return HASH_INIT;
+	}
+
+	if(cr) {
+		char buf[32];
+		double y = w->rect.y + w->baseline;
+		snprintf(buf, sizeof(buf), "%d%%", brightness);
 		cairo_set_source_rgba(cr, 0.8, 0.8, 0.8, 0.8);
-		cairo_move_to(cr, 32.0, 180.0);
-		cairo_show_text(cr, sym);
+		show_text(ui, cr, true, w->rect.x, y, u8"");
+		show_text(ui, cr, false, w->rect.x + LAYOUT_SYMBOL_WIDTH, y, buf);
+	}
+
+	return hash(HASH_INIT, &brightness, sizeof(brightness));
+}
 
-		cairo_select_font_face(cr, "DejaVu Sans",
-			CAIRO_FONT_SLANT_NORMAL, CAIRO_FONT_WEIGHT_NORMAL);
-		cairo_move_to(cr, 60.0, 180.0);
-		cairo_show_text(cr, song);
+static uint64_t power_widget(struct ui* ui, const struct widget* w,
+		cairo_t* cr) {
+	struct modules* modules = ui->modules;
+	if(!modules->power) {
+		return placeholder(ui, w, cr, dui_module_power);
 	}
 
-	// audio
-	if(modules->audio) {
-		if(mod_audio_get_muted(modules->audio)) {
-			snprintf(buf, sizeof(buf), "MUTE");
-			sym = u8"";
-		} else {
-			unsigned vol = mod_audio_get(modules->audio);
-			snprintf(buf, sizeof(buf), "%d%%", vol);
-			sym = u8"";
+	struct mod_power_status status = mod_power_get(modules->power);
+	const char* sym = battery_symbol(status);
+	char percent[32];
+	char wattage[32] = "";
+	snprintf(percent, sizeof(percent), "%d%%", status.percent);
+
+	// wattage output incorrect while charging
+	if(!status.charging) {
+		snprintf(wattage, sizeof(wattage), "%.2f W", status.wattage);
+	}
+
+	if(cr) {
+		double x = w->rect.x;
+		double y = w->rect.y + w->baseline;
+		cairo_set_source_rgba(cr, 0.8, 0.8, 0.8, 0.8);
+		show_text(ui, cr, true, x, y, sym);
+		show_text(ui, cr, false, x + LAYOUT_SYMBOL_WIDTH, y, percent);
+		if(!status.charging) {
+			x += LAYOUT_STATUS_WIDTH;
+			show_text(ui, cr, true, x, y, u8"");
+			show_text(ui, cr, false, x + 18, y, wattage);
 		}
+	}
 
-		cairo_move_to(cr, 32.0, 220.0);
-		cairo_select_font_face(cr, "FontAwesome",
-			CAIRO_FONT_SLANT_NORMAL, CAIRO_FONT_WEIGHT_NORMAL);
-		cairo_show_text(cr, sym);
+	return hash_str(hash_str(hash_str(HASH_INIT, sym), percent), wattage);
+}
 
-		cairo_select_font_face(cr, "DejaVu Sans",
-			CAIRO_FONT_SLANT_NORMAL, CAIRO_FONT_WEIGHT_NORMAL);
-		cairo_move_to(cr, 60.0, 220.0);
+static uint64_t note_widget(struct ui* ui, const struct widget* w,
+		cairo_t* cr) {
+	unsigned i = w - &ui->widgets[widget_note_first];
+	if(!ui->modules->notes) {
+		return i == 0 ? placeholder(ui, w, cr, dui_module_notes) : HASH_INIT;
+	}
 
-		cairo_show_text(cr, buf);
+	if(i >= ui->notes_count) {
+		return HASH_INIT;
 	}
 
-	// brightness
-	if(modules->brightness) {
-		int brightness = mod_brightness_get(modules->brightness);
-		if(brightness >= 0) {
-			cairo_move_to(cr, 152.0, 220.0);
-			cairo_select_font_face(cr, "FontAwesome",
-				CAIRO_FONT_SLANT_NORMAL, CAIRO_FONT_WEIGHT_NORMAL);
-			cairo_show_text(cr, u8"");
-
-			cairo_select_font_face(cr, "DejaVu Sans",
-				CAIRO_FONT_SLANT_NORMAL, CAIRO_FONT_WEIGHT_NORMAL);
-			cairo_move_to(cr, 180.0, 220.0);
-			snprintf(buf, sizeof(buf), "%d%%", brightness);
-			cairo_show_text(cr, buf);
+	const struct note* note = &ui->notes[i];
+	bool active = (i == ui->active_note);
+	if(cr) {
+		double x = w->rect.x + LAYOUT_NOTE_PADDING;
+		double y = w->rect.y + w->baseline;
+		char buf[512];
+		struct font* font = set_font(ui, cr, FONT_TEXT,
+			CAIRO_FONT_WEIGHT_NORMAL, 18.0);
+		double width = ellipsize(cr, font, note->string,
+			w->rect.width - 2 * LAYOUT_NOTE_PADDING, buf, sizeof(buf));
+		if(active) {
+			// inside the widget, its rect is the clip
+			cairo_rectangle(cr, w->rect.x, w->rect.y + 2,
+				width + 2 * LAYOUT_NOTE_PADDING, w->rect.height - 4);
+			cairo_set_source_rgba(cr, 0.2, 0.2, 0.3, 0.5);
+			cairo_fill(cr);
 		}
+
+		cairo_move_to(cr, x, y);
+		cairo_set_source_rgb(cr, 1, 1, 1);
+		cairo_show_text(cr, buf);
 	}
 
-	// power
-	if(modules->power) {
-		struct mod_power_status status = mod_power_get(modules->power);
-		const char* sym = battery_symbol(status);
+	uint64_t h = hash(HASH_INIT, &note->id, sizeof(note->id));
+	h = hash(h, &active, sizeof(active));
+	return hash_str(h, note->string);
+}
 
-		cairo_select_font_face(cr, "FontAwesome",
-			CAIRO_FONT_SLANT_NORMAL, CAIRO_FONT_WEIGHT_NORMAL);
-		cairo_move_to(cr, 272.0, 220.0);
-		cairo_show_text(cr, sym);
+static const widget_fn widget_fns[widget_note_first] = {
+	[widget_clock] = clock_widget,
+	[widget_date] = date_widget,
+	[widget_music] = music_widget,
+	[widget_audio] = audio_widget,
+	[widget_brightness] = brightness_widget,
+	[widget_power] = power_widget,
+};
 
-		cairo_select_font_face(cr, "DejaVu Sans",
-			CAIRO_FONT_SLANT_NORMAL, CAIRO_FONT_WEIGHT_NORMAL);
-		cairo_move_to(cr, 300.0, 220.0);
-		snprintf(buf, sizeof(buf), "%d%%", status.percent);
-		cairo_show_text(cr, buf);
+static widget_fn get_widget_fn(unsigned id) {
+	return id < widget_note_first ? widget_fns[id] : note_widget;
+}
 
-		// wattage output incorrect while charging
-		if(!status.charging) {
-			sym = u8"";
-
-			cairo_select_font_face(cr, "FontAwesome",
-				CAIRO_FONT_SLANT_NORMAL, CAIRO_FONT_WEIGHT_NORMAL);
-			cairo_move_to(cr, 392.0, 220.0);
-			cairo_show_text(cr, sym);
-
-			cairo_select_font_face(cr, "DejaVu Sans",
-				CAIRO_FONT_SLANT_NORMAL, CAIRO_FONT_WEIGHT_NORMAL);
-			snprintf(buf, sizeof(buf), "%.2f W", status.wattage);
-			cairo_move_to(cr, 410.0, 220.0);
-			cairo_show_text(cr, buf);
+static void clear(cairo_t* cr) {
+	cairo_set_source_rgba(cr, 0.1, 0.1, 0.1, 0.6);
+	cairo_set_operator(cr, CAIRO_OPERATOR_SOURCE);
+	cairo_paint(cr);
+	cairo_set_operator(cr, CAIRO_OPERATOR_OVER);
+}
+
+// Renders the widget, clipped to its box.
+// If clear is true, clears the box to the background first.
+static void render(struct ui* ui, cairo_t* cr, unsigned id, bool clear_box) {
+	const struct widget* w = &ui->widgets[id];
+	cairo_save(cr);
+	cairo_rectangle(cr, w->rect.x, w->rect.y, w->rect.width, w->rect.height);
+	cairo_clip(cr);
+	if(clear_box) {
+		clear(cr);
+	}
+
+	get_widget_fn(id)(ui, w, cr);
+	cairo_restore(cr);
+}
+
+struct ui_rect ui_rect_scale(struct ui_rect r, double scale) {
+	int x = floor(scale * r.x);
+	int y = floor(scale * r.y);
+	return (struct ui_rect) {x, y,
+		(int) ceil(scale * (r.x + r.width)) - x,
+		(int) ceil(scale * (r.y + r.height)) - y};
+}
+
+void ui_dashboard_damage(struct ui* ui, uint64_t since,
+		struct ui_damage* damage) {
+	damage->count = 0u;
+	if(since < ui->layout_stamp) {
+		damage->rects[damage->count++] =
+			(struct ui_rect) {0, 0, ui->width, ui->height};
+		return;
+	}
+
+	unsigned count = widget_note_first + ui->note_rows;
+	for(unsigned i = 0u; i < count; ++i) {
+		if(ui->widgets[i].version > since) {
+			damage->rects[damage->count++] = ui->widgets[i].rect;
 		}
 	}
+}
 
-	// line before notes
-	cairo_move_to(cr, 60, 250);
-	cairo_line_to(cr, width - 60, 250);
-	cairo_set_line_width(cr, 0.5);
-	cairo_stroke(cr);
+uint64_t ui_draw_dashboard(struct ui* ui, cairo_t* cr, unsigned width,
+		unsigned height, uint64_t since, struct ui_damage* damage) {
+	uint64_t start = trace_begin();
+	struct modules* modules = ui->modules;
+
+	time_t t = time(NULL);
+	localtime_r(&t, &ui->now);
+
+	// set timer to redraw dashboard when next minute happens
+	int seconds = 60 - ui->now.tm_sec;
+	struct timespec ts = { .tv_sec = seconds };
+	pml_timer_set_time_rel(ui->timer, ts);
 
-	// notes
 	if(modules->notes) {
 		ui->notes = mod_notes_get(modules->notes, &ui->notes_count);
 		if(ui->notes_count > 0 && ui->active_note >= ui->notes_count) {
 			ui->active_note = ui->notes_count - 1;
 		}
+	} else {
+		ui->notes = NULL;
+		ui->notes_count = 0u;
+	}
+
+	// update the widget versions
+	uint64_t next = ui->stamp + 1;
+	bool changed = false;
+	if(width != ui->width || height != ui->height) {
+		layout(ui, width, height);
+		ui->width = width;
+		ui->height = height;
+		ui->layout_stamp = next;
+		changed = true;
+	}
+
+	unsigned count = widget_note_first + ui->note_rows;
+	for(unsigned i = 0u; i < count; ++i) {
+		struct widget* w = &ui->widgets[i];
+		uint64_t key = get_widget_fn(i)(ui, w, NULL);
+		if(key != w->key || !w->version) {
+			w->key = key;
+			w->version = next;
+			changed = true;
+		}
+	}
 
-		float y = 300.0;
-		for(unsigned i = 0u; i < ui->notes_count; ++i) {
-			// TODO: shorten text if it doesn't fit.
-			// like it's done in the music banner
-			if(i == ui->active_note) {
-				cairo_text_extents_t extents;
-				cairo_text_extents(cr, ui->notes[i].string, &extents);
-				cairo_rectangle(cr, 20.0, y - 20, extents.width + 20, 30);
-				// cairo_rectangle(cr, 20.0, y - 20, width - 40, 30);
-				cairo_set_source_rgba(cr, 0.2, 0.2, 0.3, 0.5);
-				cairo_fill(cr);
-			}
+	if(changed) {
+		ui->stamp = next;
+	}
 
-			cairo_move_to(cr, 32.0, y);
-			cairo_set_source_rgb(cr, 1, 1, 1);
-			cairo_show_text(cr, ui->notes[i].string);
+	if(since < ui->layout_stamp) {
+		clear(cr);
 
-			y += 35;
-			if(y > 480) {
-				break;
+		// separator lines
+		cairo_set_source_rgba(cr, 0.8, 0.8, 0.8, 0.8);
+		cairo_move_to(cr, 220, ui->separators[0]);
+		cairo_line_to(cr, width - 220, ui->separators[0]);
+		cairo_set_line_width(cr, 0.4);
+		cairo_stroke(cr);
+
+		cairo_move_to(cr, 60, ui->separators[1]);
+		cairo_line_to(cr, width - 60, ui->separators[1]);
+		cairo_set_line_width(cr, 0.5);
+		cairo_stroke(cr);
+
+		for(unsigned i = 0u; i < count; ++i) {
+			render(ui, cr, i, false);
+		}
+	} else {
+		for(unsigned i = 0u; i < count; ++i) {
+			if(ui->widgets[i].version > since) {
+				render(ui, cr, i, true);
 			}
 		}
 	}
-}
 
-void ui_draw(struct ui* ui, cairo_t* cr,
-		unsigned width, unsigned height, enum banner banner) {
-	if(banner == banner_none) {
-		draw_dashboard(ui, cr, width, height);
-		return;
+	if(damage) {
+		ui_dashboard_damage(ui, since, damage);
 	}
 
+	trace_end("ui_draw dashboard", start);
+	return ui->stamp;
+}
+
+static void draw_banner(struct ui* ui, cairo_t* cr,
+		unsigned width, unsigned height, enum banner banner) {
 	struct modules* modules = ui->modules;
 
 	// background
@@ -266,12 +917,10 @@ void ui_draw(struct ui* ui, cairo_t* cr,
 	cairo_paint(cr);
 
 	const char* sym = banner_symbol(banner, modules);
-	cairo_select_font_face(cr, "FontAwesome",
-		CAIRO_FONT_SLANT_NORMAL, CAIRO_FONT_WEIGHT_NORMAL);
-	cairo_set_font_size(cr, 30.0);
+	struct font* font = set_font(ui, cr, FONT_SYMBOL,
+		CAIRO_FONT_WEIGHT_NORMAL, 30.0);
 	cairo_set_source_rgb(cr, 0.9, 0.9, 0.9);
-	cairo_move_to(cr, 20.0, 40.0);
-	cairo_show_text(cr, sym);
+	draw_text(cr, font, 20.0, 40.0, sym);
 
 	cairo_set_line_width(cr, 1.0);
 	if(banner == banner_volume || banner == banner_brightness) {
@@ -295,78 +944,33 @@ void ui_draw(struct ui* ui, cairo_t* cr,
 			song = "-";
 		}
 
-		float x = 70;
-		cairo_set_font_size(cr, 18.0);
-		cairo_move_to(cr, x, 35);
-		cairo_select_font_face(cr, "DejaVu Sans",
-			CAIRO_FONT_SLANT_NORMAL, CAIRO_FONT_WEIGHT_NORMAL);
-
-		cairo_text_extents_t extents;
-		const char* it = song;
-		unsigned count = 0;
-
-		// Trim the song string so that it will fit into the banner.
-		// If it's too long, end it with '...'. Respect utf-8 encoding
-		// (mpd is guaranteed to give us utf-8 output)
-		// NOTE: this kind of copy-check-extents-for-utf8 logic is probably
-		// useful in more than one place.
-		// hacked together, should probably be tested first.
-		// is allowed to (and will!) crash when the input string isn't
-		// valid utf8
-
-		char buf[256]; // buffer to copy the resulting string into
-		// pointers to the last three characters in buf
-		// we keep track of them so we can replace make the last three
-		// chars of the string '...' (and a null terminator)
-		char* last[3] = {NULL, NULL, NULL};
-		while(*it != '\0') {
-			unsigned len = utf8_length(it); // how many bytes does this char have?
-			if(count + len + 1 >= sizeof(buf)) {
-				printf("Error: utf8-copy-check-extents buffer too short\n");
-				if(last[2] != NULL) {
-					*last[2]++ = '.';
-					*last[2]++ = '.';
-					*last[2]++ = '.';
-					*last[2]++ = '\0';
-				}
-				break;
-			}
-
-			last[2] = last[1];
-			last[1] = last[0];
-			last[0] = &buf[count];
-			for(unsigned i = 0u; i < len && *it != '\0'; ++i) {
-				buf[count++] = *it++;
-			}
-
-			// always null-terminate the current buffer
-			// in case this is the last iterations (and we stay within the
-			// bounds we have), we can just use buf below.
-			// But it also allows us to pass last[0] (i.e. the start
-			// of the current char) to cairo since cairo needs the
-			// null-terminator
-			buf[count] = '\0';
-			cairo_text_extents(cr, last[0], &extents);
-			x += extents.x_advance;
-			if(x > width - 20) {
-				if(last[2] != NULL) {
-					*last[2]++ = '.';
-					*last[2]++ = '.';
-					*last[2]++ = '.';
-					*last[2]++ = '\0';
-				}
-
-				break;
-			}
-		}
-
+		// shorten the song string so that it fits into the banner
+		char buf[512];
+		struct font* font = set_font(ui, cr, FONT_TEXT,
+			CAIRO_FONT_WEIGHT_NORMAL, 18.0);
+		ellipsize(cr, font, song, width - 20.0 - 70.0, buf, sizeof(buf));
+		cairo_move_to(cr, 70.0, 35.0);
 		cairo_show_text(cr, buf);
 	}
 }
 
+void ui_draw(struct ui* ui, cairo_t* cr,
+		unsigned width, unsigned height, enum banner banner) {
+	if(banner == banner_none) {
+		ui_draw_dashboard(ui, cr, width, height, 0u, NULL);
+		return;
+	}
+
+	uint64_t start = trace_begin();
+	draw_banner(ui, cr, width, height, banner);
+	trace_end("ui_draw banner", start);
+}
+
 void timer_cb(struct pml_timer* timer) {
+	uint64_t start = stats_now();
 	struct ui* ui = pml_timer_get_data(timer);
 	display_redraw(ui->display, banner_none);
+	stats_record(stats_ui_timer, start);
 }
 
 struct ui* ui_create(struct modules* modules) {
@@ -374,6 +978,14 @@ struct ui* ui_create(struct modules* modules) {
 	ui->modules = modules;
 	ui->timer = pml_timer_new(dui_pml(), NULL, timer_cb);
 	pml_timer_set_data(ui->timer, ui);
+
+	// resolve all fonts up front, drawing only hits the cache
+	unsigned count = sizeof(default_fonts) / sizeof(default_fonts[0]);
+	for(unsigned i = 0u; i < count; ++i) {
+		const struct font* def = &default_fonts[i];
+		get_font(ui, def->family, def->weight, def->size, def->scale);
+	}
+
 	return ui;
 }
 
@@ -432,9 +1044,19 @@ void ui_destroy(struct ui* ui) {
 	if(ui->timer) {
 		pml_timer_destroy(ui->timer);
 	}
+	for(unsigned i = 0u; i < ui->font_count; ++i) {
+		cairo_scaled_font_destroy(ui->fonts[i].scaled);
+		free(ui->fonts[i].advances);
+		destroy_atlas(ui->fonts[i].atlas);
+	}
 	free(ui);
 }
 
 void ui_set_display(struct ui* ui, struct display* dpy) {
 	ui->display = dpy;
 }
+
+void ui_font_stats(struct ui* ui, uint64_t* hits, uint64_t* misses) {
+	*hits = ui->font_hits;
+	*misses = ui->font_misses;
+}
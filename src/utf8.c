@@ -1,4 +1,14 @@
 #include <stdlib.h>
+#include <stdint.h>
+#include <string.h>
+#include "shared.h"
+
+#ifdef __SSE2__
+#include <emmintrin.h>
+#endif
+#if defined(__x86_64__) && defined(__GNUC__)
+#include <immintrin.h>
+#endif
 
 // Taken from glib's gutf8.c.
 // Does not validate characters.
@@ -37,3 +47,278 @@ char* strlcpy_utf8(char* dst, const char* src, size_t maxncpy) {
 
     return dst_r;
 }
+
+// Decodes the character at s, with at most avail bytes available.
+// Returns its length or 0 if it's invalid (also when it's truncated).
+// Never reads beyond a null terminator.
+static unsigned decode(const unsigned char* s, size_t avail, uint32_t* out) {
+	if(s[0] < 0x80) {
+		*out = s[0];
+		return 1u;
+	}
+
+	uint32_t cp, min;
+	unsigned n;
+	if((s[0] & 0xE0) == 0xC0) {
+		cp = s[0] & 0x1F;
+		min = 0x80;
+		n = 2u;
+	} else if((s[0] & 0xF0) == 0xE0) {
+		cp = s[0] & 0x0F;
+		min = 0x800;
+		n = 3u;
+	} else if((s[0] & 0xF8) == 0xF0) {
+		cp = s[0] & 0x07;
+		min = 0x10000;
+		n = 4u;
+	} else {
+		return 0u;
+	}
+
+	if(n > avail) {
+		return 0u;
+	}
+
+	// stops at the null terminator since it's no continuation byte
+	for(unsigned i = 1u; i < n; ++i) {
+		if((s[i] & 0xC0) != 0x80) {
+			return 0u;
+		}
+		cp = (cp << 6) | (s[i] & 0x3F);
+	}
+
+	// overlong encodings, surrogates and out of range
+	if(cp < min || (cp >= 0xD800 && cp <= 0xDFFF) || cp > 0x10FFFF) {
+		return 0u;
+	}
+
+	*out = cp;
+	return n;
+}
+
+uint32_t utf8_decode(const char* src, unsigned* len) {
+	uint32_t cp;
+	*len = decode((const unsigned char*) src, 4u, &cp);
+	if(!*len) {
+		*len = 1u;
+		return UTF8_REPLACEMENT;
+	}
+
+	return cp;
+}
+
+unsigned utf8_encode(uint32_t cp, char dst[static 4]) {
+	unsigned char* d = (unsigned char*) dst;
+	if(cp < 0x80) {
+		d[0] = cp;
+		return 1u;
+	} else if(cp < 0x800) {
+		d[0] = 0xC0 | (cp >> 6);
+		d[1] = 0x80 | (cp & 0x3F);
+		return 2u;
+	} else if(cp < 0x10000) {
+		d[0] = 0xE0 | (cp >> 12);
+		d[1] = 0x80 | ((cp >> 6) & 0x3F);
+		d[2] = 0x80 | (cp & 0x3F);
+		return 3u;
+	}
+
+	d[0] = 0xF0 | (cp >> 18);
+	d[1] = 0x80 | ((cp >> 12) & 0x3F);
+	d[2] = 0x80 | ((cp >> 6) & 0x3F);
+	d[3] = 0x80 | (cp & 0x3F);
+	return 4u;
+}
+
+// Validation skips ascii runs with simd and decodes everything else.
+// Most strings (song titles, notes) are mostly ascii, multi-byte runs
+// are checked with the scalar decoder.
+typedef size_t (*ascii_prefix_fn)(const unsigned char* s, size_t len);
+
+static size_t ascii_prefix_scalar(const unsigned char* s, size_t len) {
+	size_t i = 0u;
+	while(i < len && s[i] < 0x80) {
+		++i;
+	}
+	return i;
+}
+
+#ifdef __SSE2__
+static size_t ascii_prefix_sse2(const unsigned char* s, size_t len) {
+	size_t i = 0u;
+	for(; i + 16 <= len; i += 16) {
+		__m128i v = _mm_loadu_si128((const __m128i*) (s + i));
+		if(_mm_movemask_epi8(v)) {
+			break;
+		}
+	}
+	return i + ascii_prefix_scalar(s + i, (len - i) < 16 ? len - i : 16);
+}
+#endif
+
+#if defined(__x86_64__) && defined(__GNUC__)
+#define HAVE_AVX2 1
+__attribute__((target("avx2")))
+static size_t ascii_prefix_avx2(const unsigned char* s, size_t len) {
+	size_t i = 0u;
+	for(; i + 32 <= len; i += 32) {
+		__m256i v = _mm256_loadu_si256((const __m256i*) (s + i));
+		if(_mm256_movemask_epi8(v)) {
+			break;
+		}
+	}
+	return i + ascii_prefix_scalar(s + i, (len - i) < 32 ? len - i : 32);
+}
+#else
+#define HAVE_AVX2 0
+#endif
+
+static ascii_prefix_fn ascii_prefix_best(void) {
+	static ascii_prefix_fn best = NULL;
+	if(!best) {
+		best = ascii_prefix_scalar;
+#ifdef __SSE2__
+		best = ascii_prefix_sse2;
+#endif
+#if HAVE_AVX2
+		__builtin_cpu_init();
+		if(__builtin_cpu_supports("avx2")) {
+			best = ascii_prefix_avx2;
+		}
+#endif
+	}
+
+	return best;
+}
+
+// Returns the length of the valid prefix of s.
+static size_t valid_prefix(const char* str, size_t len, ascii_prefix_fn ascii) {
+	const unsigned char* s = (const unsigned char*) str;
+	size_t i = 0u;
+	while(i < len) {
+		i += ascii(s + i, len - i);
+
+		// decode at least a chunk before trying the fast path again,
+		// non-ascii text would otherwise fall out of it for every char
+		size_t end = (len - i) < 32 ? len : i + 32;
+		while(i < end) {
+			uint32_t cp;
+			unsigned n = decode(s + i, len - i, &cp);
+			if(!n) {
+				return i;
+			}
+			i += n;
+		}
+	}
+
+	return len;
+}
+
+bool utf8_validate(const char* str, size_t len) {
+	return valid_prefix(str, len, ascii_prefix_best()) == len;
+}
+
+bool utf8_validate_scalar(const char* str, size_t len) {
+	return valid_prefix(str, len, ascii_prefix_scalar) == len;
+}
+
+size_t utf8_sanitize(char* dst, size_t size, const char* src, size_t len) {
+	if(!size) {
+		return 0u;
+	}
+
+	size_t out = 0u;
+	while(len) {
+		// copy the valid part in one go
+		size_t valid = valid_prefix(src, len, ascii_prefix_best());
+		size_t n = valid < size - 1 - out ? valid : size - 1 - out;
+		if(n < valid) {
+			// cut at a character boundary
+			while(n && (src[n] & 0xC0) == 0x80) {
+				--n;
+			}
+			memcpy(dst + out, src, n);
+			out += n;
+			break;
+		}
+
+		memcpy(dst + out, src, n);
+		out += n;
+		src += n;
+		len -= n;
+		if(!len) {
+			break;
+		}
+
+		// replace the invalid byte
+		if(out + 3 > size - 1) {
+			break;
+		}
+
+		out += utf8_encode(UTF8_REPLACEMENT, dst + out);
+		++src;
+		--len;
+	}
+
+	dst[out] = '\0';
+	return out;
+}
+
+size_t utf8_count(const char* str, size_t len) {
+	// counts all bytes that aren't continuation bytes (0x80-0xBF),
+	// i.e. as signed char aren't smaller than -64
+	const unsigned char* s = (const unsigned char*) str;
+	size_t count = 0u;
+	size_t i = 0u;
+#ifdef __SSE2__
+	const __m128i limit = _mm_set1_epi8(-65);
+	for(; i + 16 <= len; i += 16) {
+		__m128i v = _mm_loadu_si128((const __m128i*) (s + i));
+		unsigned mask = _mm_movemask_epi8(_mm_cmpgt_epi8(v, limit));
+		count += __builtin_popcount(mask);
+	}
+#endif
+	for(; i < len; ++i) {
+		count += (s[i] & 0xC0) != 0x80;
+	}
+
+	return count;
+}
+
+// Whether the codepoint extends the previous grapheme cluster.
+// Approximation of the unicode rules: combining marks, variation
+// selectors, emoji modifiers and tags.
+static bool grapheme_extend(uint32_t cp) {
+	return (cp >= 0x0300 && cp <= 0x036F) ||
+		(cp >= 0x1AB0 && cp <= 0x1AFF) ||
+		(cp >= 0x1DC0 && cp <= 0x1DFF) ||
+		(cp >= 0x20D0 && cp <= 0x20FF) ||
+		(cp >= 0xFE00 && cp <= 0xFE0F) ||
+		(cp >= 0xFE20 && cp <= 0xFE2F) ||
+		(cp >= 0x1F3FB && cp <= 0x1F3FF) ||
+		(cp >= 0xE0020 && cp <= 0xE007F) ||
+		cp == 0x200D;
+}
+
+size_t utf8_graphemes(const char* str, size_t len) {
+	const unsigned char* s = (const unsigned char*) str;
+	size_t count = 0u;
+	bool join = false; // previous codepoint was a zero width joiner
+	for(size_t i = 0u; i < len;) {
+		uint32_t cp;
+		unsigned n = decode(s + i, len - i, &cp);
+		if(!n) {
+			cp = UTF8_REPLACEMENT;
+			n = 1u;
+		}
+
+		if(!join && !grapheme_extend(cp)) {
+			++count;
+		}
+
+		join = (cp == 0x200D);
+		i += n;
+	}
+
+	return count;
+}
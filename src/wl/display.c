@@ -7,18 +7,62 @@
 #include <assert.h>
 #include <limits.h>
 #include <errno.h>
+#include <math.h>
 #include <wayland-client.h>
 #include <wayland-client-protocol.h>
 #include <cairo/cairo.h>
 #include <pml.h>
+#include "config.h"
 #include "wlr-layer-shell-unstable-v1-client-protocol.h"
 #include "xdg-output-unstable-v1-client-protocol.h"
+#if WITH_WL_FRACTIONAL_SCALE
+#include "viewporter-client-protocol.h"
+#include "fractional-scale-v1-client-protocol.h"
+#endif
 #include "display.h"
 #include "ui.h"
 #include "shared.h"
 #include "pool-buffer.h"
 
 static char* last_wl_log = NULL;
+struct display_wl;
+
+// A wl_output with the logical geometry and name from xdg-output
+// (if the compositor supports it).
+struct output {
+	struct display_wl* dpy;
+	struct wl_list link;
+	uint32_t global; // registry name
+	struct wl_output* output;
+	struct zxdg_output_v1* xdg_output;
+	int32_t scale;
+	int32_t x, y, width, height; // logical
+	char* name; // NULL if not known (yet)
+};
+
+// The layer surface for one role, i.e. the dashboard or banners.
+struct layer {
+	struct display_wl* dpy;
+	struct wl_surface* surface;
+	struct zwlr_layer_surface_v1* layer_surface;
+	struct wl_callback* frame_callback;
+	bool configured;
+	bool mapped; // whether a buffer is attached
+	bool redraw;
+	unsigned width, height; // size of the last configure
+	uint64_t stamp; // dashboard stamp of the last commit, 0 if none
+	struct output* output; // requested output, NULL for the compositor's choice
+	struct output* entered; // output the surface was last shown on
+	double scale; // scale of the last commit, 0 if none
+#if WITH_WL_FRACTIONAL_SCALE
+	// with fractional scaling, buffers are scaled down to the
+	// logical size with a viewport instead of a buffer scale
+	struct wp_viewport* viewport;
+	struct wp_fractional_scale_v1* fractional_scale;
+	double preferred_scale; // 0 until the compositor sent one
+#endif
+};
+
 struct display_wl {
 	struct display base;
 	struct ui* ui;
@@ -30,22 +74,37 @@ struct display_wl {
 	struct wl_seat* seat;
 	struct wl_keyboard* keyboard;
 	struct zwlr_layer_shell_v1* layer_shell;
-
-	bool redraw;
-	struct wl_callback* frame_callback;
-	struct wl_surface* surface;
-	struct zwlr_layer_surface_v1* layer_surface;
-	struct pool_buffer buffers[2];
+	struct zxdg_output_manager_v1* output_manager;
+#if WITH_WL_FRACTIONAL_SCALE
+	struct wp_viewporter* viewporter;
+	struct wp_fractional_scale_manager_v1* fractional_scale_manager;
+#endif
+	struct wl_list outputs;
+	const char* output_name; // DUI_OUTPUT, where banners and dashboard go
+
+	struct layer dashboard_layer;
+	struct layer banner_layer;
+	struct buffer_pool pool;
+
+	// Scale and output of the last commit. Layers are usually destroyed
+	// when hidden, this is used for their first frame until the
+	// compositor tells them their scale again.
+	double last_scale; // 0 if nothing was committed yet
+	struct output* last_output; // NULL if unknown
+
+	// Whether the layer surfaces are only unmapped when hidden instead
+	// of destroyed, see DUI_WL_KEEP_SURFACES. Saves recreating the
+	// surface objects when showing them again, a new configure is
+	// still needed after each unmap.
+	bool keep_surfaces;
 
 	struct pml_custom* source;
 	struct pml_timer* timer;
 
 	bool error;
 	bool ready; // whether there are events to be dispatched
-	bool configured;
 	bool dashboard;
 	enum banner banner;
-	unsigned width, height;
 };
 
 static bool check_error(struct display_wl* dpy) {
@@ -210,11 +269,7 @@ static unsigned fd_query(struct pml_custom* c, struct pollfd* fds,
 	return 1;
 }
 
-static void fd_dispatch(struct pml_custom* c, struct pollfd* fds, unsigned n_fds) {
-	(void) fds;
-	(void) n_fds;
-
-	struct display_wl* dpy = (struct display_wl*) pml_custom_get_data(c);
+static void dispatch(struct display_wl* dpy) {
 	bool ready = dpy->ready;
 	dpy->ready = false;
 
@@ -239,19 +294,74 @@ static void fd_dispatch(struct pml_custom* c, struct pollfd* fds, unsigned n_fds
 	wl_display_dispatch_pending(dpy->display);
 }
 
+static void fd_dispatch(struct pml_custom* c, struct pollfd* fds, unsigned n_fds) {
+	(void) fds;
+	(void) n_fds;
+
+	uint64_t start = stats_now();
+	dispatch((struct display_wl*) pml_custom_get_data(c));
+	stats_record(stats_display, start);
+}
+
 static const struct pml_custom_impl custom_impl = {
 	.prepare = fd_prepare,
 	.query = fd_query,
 	.dispatch = fd_dispatch
 };
 
+static void destroy_layer(struct layer* layer) {
+#if WITH_WL_FRACTIONAL_SCALE
+	if(layer->fractional_scale) wp_fractional_scale_v1_destroy(layer->fractional_scale);
+	if(layer->viewport) wp_viewport_destroy(layer->viewport);
+	layer->fractional_scale = NULL;
+	layer->viewport = NULL;
+	layer->preferred_scale = 0.0;
+#endif
+	if(layer->frame_callback) wl_callback_destroy(layer->frame_callback);
+	if(layer->layer_surface) zwlr_layer_surface_v1_destroy(layer->layer_surface);
+	if(layer->surface) wl_surface_destroy(layer->surface);
+	layer->frame_callback = NULL;
+	layer->layer_surface = NULL;
+	layer->surface = NULL;
+	layer->configured = false;
+	layer->mapped = false;
+	layer->redraw = false;
+	layer->width = layer->height = 0;
+	layer->stamp = 0u;
+	layer->output = NULL;
+	layer->entered = NULL;
+	layer->scale = 0.0;
+}
+
+static void destroy_output(struct output* output) {
+	if(output->xdg_output) zxdg_output_v1_destroy(output->xdg_output);
+	if(wl_output_get_version(output->output) >= WL_OUTPUT_RELEASE_SINCE_VERSION) {
+		wl_output_release(output->output);
+	} else {
+		wl_output_destroy(output->output);
+	}
+	wl_list_remove(&output->link);
+	free(output->name);
+	free(output);
+}
+
 static void destroy(struct display* base) {
 	struct display_wl* dpy = (struct display_wl*) base;
-	destroy_buffer(&dpy->buffers[0]);
-	destroy_buffer(&dpy->buffers[1]);
-	if(dpy->frame_callback) wl_callback_destroy(dpy->frame_callback);
-	if(dpy->layer_surface) zwlr_layer_surface_v1_destroy(dpy->layer_surface);
-	if(dpy->surface) wl_surface_destroy(dpy->surface);
+	destroy_layer(&dpy->dashboard_layer);
+	destroy_layer(&dpy->banner_layer);
+	destroy_buffer_pool(&dpy->pool);
+	struct output* output;
+	struct output* tmp;
+	wl_list_for_each_safe(output, tmp, &dpy->outputs, link) {
+		destroy_output(output);
+	}
+	if(dpy->output_manager) zxdg_output_manager_v1_destroy(dpy->output_manager);
+#if WITH_WL_FRACTIONAL_SCALE
+	if(dpy->viewporter) wp_viewporter_destroy(dpy->viewporter);
+	if(dpy->fractional_scale_manager) {
+		wp_fractional_scale_manager_v1_destroy(dpy->fractional_scale_manager);
+	}
+#endif
 	if(dpy->compositor) wl_compositor_destroy(dpy->compositor);
 	if(dpy->shm) wl_shm_destroy(dpy->shm);
 	if(dpy->layer_shell) zwlr_layer_shell_v1_destroy(dpy->layer_shell);
@@ -260,29 +370,79 @@ static void destroy(struct display* base) {
 	if(dpy->source) pml_custom_destroy(dpy->source);
 }
 
+// Hides the layer. When surfaces are kept, it is unmapped by attaching
+// a NULL buffer, otherwise destroyed. An unmapped layer surface is
+// unconfigured again, see create_layer.
+static void unmap_layer(struct display_wl* dpy, struct layer* layer) {
+	if(!dpy->keep_surfaces || !layer->configured) {
+		destroy_layer(layer);
+		return;
+	}
+
+	if(layer->frame_callback) {
+		wl_callback_destroy(layer->frame_callback);
+		layer->frame_callback = NULL;
+	}
+
+	layer->redraw = false;
+	layer->stamp = 0u;
+	if(layer->mapped) {
+		wl_surface_attach(layer->surface, NULL, 0, 0);
+		wl_surface_commit(layer->surface);
+		layer->mapped = false;
+		layer->configured = false;
+	}
+}
+
 static void hide(struct display_wl* dpy) {
-	if(dpy->layer_surface) zwlr_layer_surface_v1_destroy(dpy->layer_surface);
-	if(dpy->surface) wl_surface_destroy(dpy->surface);
-	if(dpy->frame_callback) wl_callback_destroy(dpy->frame_callback);
+	unmap_layer(dpy, &dpy->dashboard_layer);
+	unmap_layer(dpy, &dpy->banner_layer);
 	dpy->banner = banner_none;
 	dpy->dashboard = false;
-	dpy->layer_surface = NULL;
-	dpy->surface = NULL;
-	dpy->frame_callback = NULL;
-	dpy->width = dpy->height = 0;
-	dpy->configured = false;
 	pml_timer_disable(dpy->timer);
 }
 
-static void draw(struct display_wl* dpy);
-static void frame_done(void* data, struct wl_callback* cb, uint32_t value) {
-	struct display_wl* dpy = data;
-	wl_callback_destroy(dpy->frame_callback);
-	dpy->frame_callback = NULL;
+// The scale the layer should be drawn with: the one preferred by the
+// compositor with fractional scaling, otherwise the scale of the output
+// it is on. Before the compositor told us, the scale of the last commit
+// if it went to the same output, otherwise the one of the requested
+// (or only) output.
+static double layer_scale(const struct layer* layer) {
+	const struct display_wl* dpy = layer->dpy;
+#if WITH_WL_FRACTIONAL_SCALE
+	if(layer->preferred_scale > 0.0) {
+		return layer->preferred_scale;
+	}
+#endif
+	if(layer->entered) {
+		return layer->entered->scale;
+	}
+
+	const struct output* output = layer->output;
+	if(!output && wl_list_length(&dpy->outputs) == 1) {
+		output = wl_container_of(dpy->outputs.next, output, link);
+	}
+
+	if(dpy->last_scale > 0.0 && (!layer->output ||
+			layer->output == dpy->last_output)) {
+		return dpy->last_scale;
+	} else if(output) {
+		return output->scale;
+	}
+	return 1.0;
+}
 
-	if(dpy->redraw) {
-		dpy->redraw = false;
-		draw(dpy);
+static void draw(struct display_wl* dpy, struct layer* layer);
+static void refresh(struct display_wl* dpy, struct layer* layer);
+static void frame_done(void* data, struct wl_callback* cb, uint32_t value) {
+	struct layer* layer = data;
+	trace_instant("wl frame_done");
+	wl_callback_destroy(layer->frame_callback);
+	layer->frame_callback = NULL;
+
+	if(layer->redraw) {
+		layer->redraw = false;
+		draw(layer->dpy, layer);
 	}
 }
 
@@ -290,51 +450,115 @@ static const struct wl_callback_listener frame_callback_listener = {
 	.done = frame_done,
 };
 
-static void draw(struct display_wl* dpy) {
-	if((!dpy->dashboard && dpy->banner == banner_none) ||
-			(dpy->width == 0 || dpy->height == 0)) {
-		wl_surface_attach(dpy->surface, NULL, 0, 0);
+// Draws the dashboard into buf and damages the regions that changed
+// since the last commit. Returns false if nothing changed.
+static bool draw_dashboard(struct display_wl* dpy, struct layer* layer,
+		struct pool_buffer* buf, double scale) {
+	// the buffer is redrawn where it is stale, i.e. the union of the
+	// damage since it was last used. The compositor only needs the
+	// damage relative to the previous commit though.
+	buf->stamp = ui_draw_dashboard(dpy->ui, buf->cairo, layer->width,
+		layer->height, buf->stamp, NULL);
+
+	struct ui_damage damage;
+	ui_dashboard_damage(dpy->ui, layer->stamp, &damage);
+	layer->stamp = buf->stamp;
+
+	for(unsigned i = 0u; i < damage.count; ++i) {
+		struct ui_rect r = ui_rect_scale(damage.rects[i], scale);
+		wl_surface_damage_buffer(layer->surface, r.x, r.y, r.width, r.height);
+	}
+
+	return damage.count > 0;
+}
+
+static void draw(struct display_wl* dpy, struct layer* layer) {
+	bool dashboard = (layer == &dpy->dashboard_layer);
+	if((dashboard && !dpy->dashboard) ||
+			(!dashboard && dpy->banner == banner_none) ||
+			(layer->width == 0 || layer->height == 0)) {
+		return;
+	}
+
+	// buffers are in output pixels and have the scale as device scale,
+	// the ui draws in logical coordinates
+	uint64_t start = trace_begin();
+	double scale = layer_scale(layer);
+	if(scale != layer->scale) {
+		layer->stamp = 0u;
+	}
+
+	uint32_t width = round(scale * layer->width);
+	uint32_t height = round(scale * layer->height);
+	struct pool_buffer* buf = get_next_buffer(dpy->shm, &dpy->pool,
+		width, height, scale);
+	assert(buf);
+
+	bool present = true;
+	if(dashboard) {
+		present = draw_dashboard(dpy, layer, buf, scale);
 	} else {
-		struct pool_buffer* buf = get_next_buffer(dpy->shm, dpy->buffers,
-			dpy->width, dpy->height);
-		assert(buf);
-		ui_draw(dpy->ui, buf->cairo, dpy->width, dpy->height,
-			dpy->dashboard ? banner_none : dpy->banner);
+		ui_draw(dpy->ui, buf->cairo, layer->width, layer->height, dpy->banner);
+		wl_surface_damage_buffer(layer->surface, 0, 0, width, height);
+		buf->stamp = 0u;
+	}
+
+	if(present) {
 		cairo_surface_flush(buf->surface);
-		wl_surface_attach(dpy->surface, buf->buffer, 0, 0);
-		dpy->frame_callback = wl_surface_frame(dpy->surface);
-		wl_callback_add_listener(dpy->frame_callback, &frame_callback_listener, dpy);
+#if WITH_WL_FRACTIONAL_SCALE
+		if(layer->viewport) {
+			wp_viewport_set_destination(layer->viewport,
+				layer->width, layer->height);
+		} else {
+			wl_surface_set_buffer_scale(layer->surface, (int32_t) scale);
+		}
+#else
+		wl_surface_set_buffer_scale(layer->surface, (int32_t) scale);
+#endif
+		layer->scale = scale;
+		dpy->last_scale = scale;
+		dpy->last_output = layer->entered ? layer->entered : layer->output;
+		wl_surface_attach(layer->surface, buf->buffer, 0, 0);
+		layer->frame_callback = wl_surface_frame(layer->surface);
+		wl_callback_add_listener(layer->frame_callback,
+			&frame_callback_listener, layer);
+		wl_surface_commit(layer->surface);
+		layer->mapped = true;
+	} else {
+		// nothing changed, the buffer stays unused
+		buf->busy = false;
 	}
 
-	wl_surface_damage(dpy->surface, 0, 0, INT32_MAX, INT32_MAX);
-	wl_surface_commit(dpy->surface);
+	trace_end("wl draw", start);
 }
 
-static void refresh(struct display_wl* dpy) {
-	if(dpy->frame_callback || !dpy->configured) {
-		dpy->redraw = true;
+static void refresh(struct display_wl* dpy, struct layer* layer) {
+	if(layer->frame_callback || !layer->configured) {
+		layer->redraw = true;
 		return;
 	}
 
-	draw(dpy);
+	draw(dpy, layer);
 }
 
 static void timer_cb(struct pml_timer* timer) {
+	uint64_t start = stats_now();
 	struct display_wl* dpy = pml_timer_get_data(timer);
 	assert(dpy->banner != banner_none);
 	assert(!dpy->dashboard);
 	hide(dpy);
+	stats_record(stats_display_timer, start);
 }
 
 static void layer_surface_configure(void *data,
 		struct zwlr_layer_surface_v1 *surface,
 		uint32_t serial, uint32_t width, uint32_t height) {
-	struct display_wl* dpy = data;
-	dpy->width = width;
-	dpy->height = height;
-	dpy->configured = true;
+	struct layer* layer = data;
+	layer->width = width;
+	layer->height = height;
+	layer->configured = true;
 	zwlr_layer_surface_v1_ack_configure(surface, serial);
-	refresh(dpy);
+	refresh(layer->dpy, layer);
 }
 
 static void layer_surface_closed(void *data,
@@ -345,7 +569,9 @@ static void layer_surface_closed(void *data,
 	// NOTE: the correct way to handle it is probably
 	// to unmap the dashboard/banner if it is open.
 	// not sure about those semantics though
-	struct display_wl* dpy = data;
+	struct layer* layer = data;
+	struct display_wl* dpy = layer->dpy;
+	destroy_layer(layer);
 	hide(dpy);
 }
 
@@ -354,6 +580,145 @@ static const struct zwlr_layer_surface_v1_listener layer_surface_listener = {
 	.closed = layer_surface_closed,
 };
 
+static void surface_enter(void* data, struct wl_surface* surface,
+		struct wl_output* wl_output) {
+	struct layer* layer = data;
+	struct output* output = wl_output_get_user_data(wl_output);
+	if(!output || output == layer->entered) {
+		return;
+	}
+
+	layer->entered = output;
+	if(layer->mapped && output->scale != layer->scale) {
+		refresh(layer->dpy, layer);
+	}
+}
+
+static void surface_leave(void* data, struct wl_surface* surface,
+		struct wl_output* wl_output) {
+	struct layer* layer = data;
+	if(layer->entered && layer->entered->output == wl_output) {
+		layer->entered = NULL;
+	}
+}
+
+static const struct wl_surface_listener surface_listener = {
+	.enter = surface_enter,
+	.leave = surface_leave,
+};
+
+#if WITH_WL_FRACTIONAL_SCALE
+static void fractional_scale_preferred(void* data,
+		struct wp_fractional_scale_v1* fractional_scale, uint32_t scale) {
+	struct layer* layer = data;
+	layer->preferred_scale = scale / 120.0;
+	if(layer->mapped && layer->preferred_scale != layer->scale) {
+		refresh(layer->dpy, layer);
+	}
+}
+
+static const struct wp_fractional_scale_v1_listener fractional_scale_listener = {
+	.preferred_scale = fractional_scale_preferred,
+};
+#endif
+
+// outputs
+static void output_geometry(void* data, struct wl_output* wl_output,
+		int32_t x, int32_t y, int32_t phys_width, int32_t phys_height,
+		int32_t subpixel, const char* make, const char* model,
+		int32_t transform) {
+}
+
+static void output_mode(void* data, struct wl_output* wl_output,
+		uint32_t flags, int32_t width, int32_t height, int32_t refresh) {
+}
+
+static void output_done(void* data, struct wl_output* wl_output) {
+	// redraw layers whose buffer scale is outdated
+	struct output* output = data;
+	struct display_wl* dpy = output->dpy;
+	struct layer* layers[] = {&dpy->dashboard_layer, &dpy->banner_layer};
+	for(unsigned i = 0u; i < 2; ++i) {
+		struct layer* layer = layers[i];
+		if(layer->mapped && layer_scale(layer) != layer->scale) {
+			refresh(dpy, layer);
+		}
+	}
+}
+
+static void output_scale(void* data, struct wl_output* wl_output,
+		int32_t factor) {
+	struct output* output = data;
+	output->scale = factor;
+}
+
+static const struct wl_output_listener output_listener = {
+	.geometry = output_geometry,
+	.mode = output_mode,
+	.done = output_done,
+	.scale = output_scale,
+};
+
+static void xdg_output_logical_position(void* data,
+		struct zxdg_output_v1* xdg_output, int32_t x, int32_t y) {
+	struct output* output = data;
+	output->x = x;
+	output->y = y;
+}
+
+static void xdg_output_logical_size(void* data,
+		struct zxdg_output_v1* xdg_output, int32_t width, int32_t height) {
+	struct output* output = data;
+	output->width = width;
+	output->height = height;
+}
+
+static void xdg_output_done(void* data, struct zxdg_output_v1* xdg_output) {
+}
+
+static void xdg_output_name(void* data, struct zxdg_output_v1* xdg_output,
+		const char* name) {
+	struct output* output = data;
+	free(output->name);
+	output->name = strdup(name);
+}
+
+static void xdg_output_description(void* data,
+		struct zxdg_output_v1* xdg_output, const char* description) {
+}
+
+static const struct zxdg_output_v1_listener xdg_output_listener = {
+	.logical_position = xdg_output_logical_position,
+	.logical_size = xdg_output_logical_size,
+	.done = xdg_output_done,
+	.name = xdg_output_name,
+	.description = xdg_output_description,
+};
+
+static void create_xdg_output(struct display_wl* dpy, struct output* output) {
+	output->xdg_output = zxdg_output_manager_v1_get_xdg_output(
+		dpy->output_manager, output->output);
+	zxdg_output_v1_add_listener(output->xdg_output,
+		&xdg_output_listener, output);
+}
+
+// Returns the output selected with DUI_OUTPUT.
+// NULL if there is none, the compositor chooses then.
+static struct output* find_output(struct display_wl* dpy) {
+	if(!dpy->output_name) {
+		return NULL;
+	}
+
+	struct output* output;
+	wl_list_for_each(output, &dpy->outputs, link) {
+		if(output->name && strcmp(output->name, dpy->output_name) == 0) {
+			return output;
+		}
+	}
+
+	return NULL;
+}
+
 static void keyboard_keymap_cb(void *data, struct wl_keyboard *wl_keyboard,
 		uint32_t format, int32_t fd, uint32_t size) {
 	printf("keymap\n");
@@ -373,12 +738,13 @@ static void keyboard_key_cb(void *data, struct wl_keyboard *wl_keyboard,
 	// key += 8;
 	// printf("key %d %d\n", key, state);
 	struct display_wl* dpy = data;
+	trace_instant("key");
 	if(dpy->dashboard && state == 1 && ui_key(dpy->ui, key)) {
 		hide(dpy);
 	} else {
 		// TODO: don't always do this. ui should be able to trigger
 		// it i guess
-		refresh(dpy);
+		refresh(dpy, &dpy->dashboard_layer);
 	}
 }
 
@@ -438,12 +804,71 @@ static void handle_global(void *data, struct wl_registry *registry,
 	} else if(strcmp(interface, zwlr_layer_shell_v1_interface.name) == 0) {
 		dpy->layer_shell = wl_registry_bind(registry, name,
 			&zwlr_layer_shell_v1_interface, 1);
+	} else if(strcmp(interface, wl_output_interface.name) == 0) {
+		struct output* output = calloc(1, sizeof(*output));
+		output->dpy = dpy;
+		output->global = name;
+		output->scale = 1;
+		output->output = wl_registry_bind(registry, name,
+			&wl_output_interface, version < 3 ? version : 3);
+		wl_output_add_listener(output->output, &output_listener, output);
+		wl_list_insert(&dpy->outputs, &output->link);
+		if(dpy->output_manager) {
+			create_xdg_output(dpy, output);
+		}
+#if WITH_WL_FRACTIONAL_SCALE
+	} else if(strcmp(interface, wp_viewporter_interface.name) == 0) {
+		dpy->viewporter = wl_registry_bind(registry, name,
+			&wp_viewporter_interface, 1);
+	} else if(strcmp(interface, wp_fractional_scale_manager_v1_interface.name) == 0) {
+		dpy->fractional_scale_manager = wl_registry_bind(registry, name,
+			&wp_fractional_scale_manager_v1_interface, 1);
+#endif
+	} else if(strcmp(interface, zxdg_output_manager_v1_interface.name) == 0) {
+		dpy->output_manager = wl_registry_bind(registry, name,
+			&zxdg_output_manager_v1_interface, version < 2 ? version : 2);
+		struct output* output;
+		wl_list_for_each(output, &dpy->outputs, link) {
+			create_xdg_output(dpy, output);
+		}
 	}
 }
 
 static void handle_global_remove(void *data, struct wl_registry *registry,
 		uint32_t name) {
-	// TODO: handle
+	struct display_wl* dpy = data;
+	struct output* output;
+	wl_list_for_each(output, &dpy->outputs, link) {
+		if(output->global != name) {
+			continue;
+		}
+
+		// layers created for the output are gone with it. The ones the
+		// compositor placed are moved by it, they are just not on
+		// this output anymore
+		struct layer* layers[] = {&dpy->dashboard_layer, &dpy->banner_layer};
+		bool visible = false;
+		for(unsigned i = 0u; i < 2; ++i) {
+			if(layers[i]->output == output) {
+				visible |= layers[i]->mapped;
+				destroy_layer(layers[i]);
+			} else if(layers[i]->entered == output) {
+				layers[i]->entered = NULL;
+			}
+		}
+
+		if(visible) {
+			hide(dpy);
+		}
+
+		if(dpy->last_output == output) {
+			dpy->last_output = NULL;
+			dpy->last_scale = 0.0;
+		}
+
+		destroy_output(output);
+		return;
+	}
 }
 
 static const struct wl_registry_listener registry_listener = {
@@ -451,15 +876,67 @@ static const struct wl_registry_listener registry_listener = {
 	.global_remove = handle_global_remove,
 };
 
-static void check_surface(struct display_wl* dpy) {
-	if(!dpy->surface) {
-		dpy->surface = wl_compositor_create_surface(dpy->compositor);
-		dpy->layer_surface = zwlr_layer_shell_v1_get_layer_surface(
-			dpy->layer_shell, dpy->surface, NULL,
-			ZWLR_LAYER_SHELL_V1_LAYER_OVERLAY, "dui");
-		zwlr_layer_surface_v1_add_listener(dpy->layer_surface,
-			&layer_surface_listener, dpy);
+// Creates the surface of the layer if it doesn't exist yet.
+// It will be drawn on the first configure.
+// Kept surfaces are recreated when the selected output changed.
+static void create_layer(struct display_wl* dpy, struct layer* layer) {
+	struct output* output = find_output(dpy);
+	if(layer->surface && layer->output == output) {
+		// a kept surface that was unmapped has to be committed without
+		// buffer again, the first frame is drawn on the new configure
+		if(!layer->configured) {
+			wl_surface_commit(layer->surface);
+		}
+		return;
+	}
+
+	destroy_layer(layer);
+	layer->output = output;
+	layer->surface = wl_compositor_create_surface(dpy->compositor);
+	wl_surface_add_listener(layer->surface, &surface_listener, layer);
+#if WITH_WL_FRACTIONAL_SCALE
+	if(dpy->viewporter && dpy->fractional_scale_manager) {
+		layer->viewport = wp_viewporter_get_viewport(dpy->viewporter,
+			layer->surface);
+		layer->fractional_scale =
+			wp_fractional_scale_manager_v1_get_fractional_scale(
+				dpy->fractional_scale_manager, layer->surface);
+		wp_fractional_scale_v1_add_listener(layer->fractional_scale,
+			&fractional_scale_listener, layer);
+	}
+#endif
+	layer->layer_surface = zwlr_layer_shell_v1_get_layer_surface(
+		dpy->layer_shell, layer->surface, output ? output->output : NULL,
+		ZWLR_LAYER_SHELL_V1_LAYER_OVERLAY, "dui");
+	zwlr_layer_surface_v1_add_listener(layer->layer_surface,
+		&layer_surface_listener, layer);
+
+	if(layer == &dpy->dashboard_layer) {
+		// don't exceed the logical size of the output
+		unsigned width = start_width, height = start_height;
+		if(output && output->width > 0 && (unsigned) output->width < width) {
+			width = output->width;
+		}
+		if(output && output->height > 0 && (unsigned) output->height < height) {
+			height = output->height;
+		}
+
+		zwlr_layer_surface_v1_set_size(layer->layer_surface, width, height);
+		zwlr_layer_surface_v1_set_anchor(layer->layer_surface, 0);
+		zwlr_layer_surface_v1_set_keyboard_interactivity(layer->layer_surface, 1);
+		zwlr_layer_surface_v1_set_margin(layer->layer_surface, 0, 0, 0, 0);
+	} else {
+		zwlr_layer_surface_v1_set_size(layer->layer_surface,
+			banner_width, banner_height);
+		zwlr_layer_surface_v1_set_anchor(layer->layer_surface,
+			ZWLR_LAYER_SURFACE_V1_ANCHOR_BOTTOM |
+			ZWLR_LAYER_SURFACE_V1_ANCHOR_RIGHT);
+		zwlr_layer_surface_v1_set_margin(layer->layer_surface,
+			0, banner_margin_x, banner_margin_y, 0);
+		zwlr_layer_surface_v1_set_keyboard_interactivity(layer->layer_surface, 0);
 	}
+
+	wl_surface_commit(layer->surface);
 }
 
 static void log_handler(const char* format, va_list vlist) {
@@ -485,20 +962,11 @@ static void toggle_dashboard(struct display* base) {
 		if(dpy->banner != banner_none) { // hide banner
 			dpy->banner = banner_none;
 			pml_timer_disable(dpy->timer);
+			unmap_layer(dpy, &dpy->banner_layer);
 		}
 
-		dpy->width = start_width;
-		dpy->height = start_height;
-
-		check_surface(dpy);
-		zwlr_layer_surface_v1_set_size(dpy->layer_surface,
-			dpy->width, dpy->height);
-		zwlr_layer_surface_v1_set_anchor(dpy->layer_surface, 0);
-		zwlr_layer_surface_v1_set_keyboard_interactivity(dpy->layer_surface, 1);
-		zwlr_layer_surface_v1_set_margin(dpy->layer_surface, 0, 0, 0, 0);
-		wl_surface_commit(dpy->surface);
-
-		refresh(dpy);
+		create_layer(dpy, &dpy->dashboard_layer);
+		refresh(dpy, &dpy->dashboard_layer);
 	} else {
 		hide(dpy);
 	}
@@ -506,8 +974,10 @@ static void toggle_dashboard(struct display* base) {
 
 static void redraw(struct display* base, enum banner banner) {
 	struct display_wl* dpy = (struct display_wl*) base;
-	if(dpy->dashboard || (banner != banner_none && dpy->banner == banner)) {
-		refresh(dpy);
+	if(dpy->dashboard) {
+		refresh(dpy, &dpy->dashboard_layer);
+	} else if(banner != banner_none && dpy->banner == banner) {
+		refresh(dpy, &dpy->banner_layer);
 	}
 }
 
@@ -518,23 +988,11 @@ static void show_banner(struct display* base, enum banner banner) {
 		return;
 	}
 
-	if(dpy->banner == banner_none) {
-		check_surface(dpy);
-		zwlr_layer_surface_v1_set_size(dpy->layer_surface,
-			banner_width, banner_height);
-		zwlr_layer_surface_v1_set_anchor(dpy->layer_surface,
-			ZWLR_LAYER_SURFACE_V1_ANCHOR_BOTTOM |
-			ZWLR_LAYER_SURFACE_V1_ANCHOR_RIGHT);
-		zwlr_layer_surface_v1_set_margin(dpy->layer_surface,
-			0, banner_margin_x, banner_margin_y, 0);
-		zwlr_layer_surface_v1_set_keyboard_interactivity(dpy->layer_surface, 0);
-		wl_surface_commit(dpy->surface);
-		dpy->width = banner_width;
-		dpy->height = banner_height;
-	}
-
+	// a kept surface only saves recreating the objects, it is drawn
+	// on the next configure like a new one
+	create_layer(dpy, &dpy->banner_layer);
 	dpy->banner = banner;
-	refresh(dpy);
+	refresh(dpy, &dpy->banner_layer);
 
 	// set timeout on timer
 	// this will automatically override previously queued timers
@@ -562,11 +1020,30 @@ struct display* display_create_wl(struct ui* ui) {
 	dpy->base.impl = &display_impl;
 	dpy->display = wld;
 	dpy->ui = ui;
+	dpy->dashboard_layer.dpy = dpy;
+	dpy->banner_layer.dpy = dpy;
+	wl_list_init(&dpy->outputs);
+
+	const char* keep = getenv("DUI_WL_KEEP_SURFACES");
+	dpy->keep_surfaces = keep && keep[0] != '\0' && strcmp(keep, "0") != 0;
+
+	const char* output = getenv("DUI_OUTPUT");
+	if(output && output[0] != '\0') {
+		dpy->output_name = output;
+	}
 
 	dpy->registry = wl_display_get_registry(wld);
 	wl_registry_add_listener(dpy->registry, &registry_listener, dpy);
 	wl_display_roundtrip(dpy->display);
 
+	// output names and scales
+	wl_display_roundtrip(dpy->display);
+	if(dpy->output_name && !dpy->output_manager) {
+		printf("wayland: no xdg-output support, ignoring DUI_OUTPUT\n");
+	} else if(dpy->output_name && !find_output(dpy)) {
+		printf("wayland: output '%s' not found (yet)\n", dpy->output_name);
+	}
+
 	const char* missing = NULL;
 	if(!dpy->layer_shell) missing = "wlr_layer_shell";
 	if(!dpy->shm) missing = "wl_shm";
@@ -22,7 +22,8 @@
 // https://github.com/swaywm/sway
 // https://github.com/swaywm/swaybg
 
-#define _POSIX_C_SOURCE 200809
+// memfd_create, F_ADD_SEALS
+#define _GNU_SOURCE
 
 #include <assert.h>
 #include <cairo/cairo.h>
@@ -82,6 +83,29 @@ static int create_pool_file(size_t size, char **name) {
 	return fd;
 }
 
+static int create_pool_fd(size_t size) {
+	int fd = memfd_create("dui-shm", MFD_CLOEXEC | MFD_ALLOW_SEALING);
+	if (fd >= 0) {
+		// the pool only grows. Guarantee the compositor that it
+		// never shrinks, so it can't get SIGBUS when reading buffers
+		if (ftruncate(fd, size) < 0 ||
+				fcntl(fd, F_ADD_SEALS, F_SEAL_SHRINK | F_SEAL_SEAL) < 0) {
+			close(fd);
+			return -1;
+		}
+		return fd;
+	}
+
+	// fall back to a file when memfd isn't supported
+	char *name = NULL;
+	fd = create_pool_file(size, &name);
+	if (fd >= 0) {
+		unlink(name);
+	}
+	free(name);
+	return fd;
+}
+
 static void buffer_release(void *data, struct wl_buffer *wl_buffer) {
 	struct pool_buffer *buffer = data;
 	buffer->busy = false;
@@ -91,38 +115,124 @@ static const struct wl_buffer_listener buffer_listener = {
 	.release = buffer_release
 };
 
-static struct pool_buffer *create_buffer(struct wl_shm *shm,
-		struct pool_buffer *buf, int32_t width, int32_t height,
-		uint32_t format) {
-	uint32_t stride = width * 4;
-	size_t size = stride * height;
-
-	char *name;
-	int fd = create_pool_file(size, &name);
-	assert(fd != -1);
-	void *data = mmap(NULL, size, PROT_READ | PROT_WRITE, MAP_SHARED, fd, 0);
-	struct wl_shm_pool *pool = wl_shm_create_pool(shm, fd, size);
-	buf->buffer = wl_shm_pool_create_buffer(pool, 0,
-			width, height, stride, format);
-	wl_shm_pool_destroy(pool);
-	close(fd);
-	unlink(name);
-	free(name);
-	fd = -1;
+// (Re-)creates the cairo surface of the buffer for the current mapping.
+static void map_buffer(struct buffer_pool *pool, struct pool_buffer *buf) {
+	if (buf->cairo) {
+		cairo_destroy(buf->cairo);
+	}
+	if (buf->surface) {
+		cairo_surface_destroy(buf->surface);
+	}
 
-	buf->size = size;
-	buf->width = width;
-	buf->height = height;
-	buf->data = data;
-	buf->surface = cairo_image_surface_create_for_data(data,
-			CAIRO_FORMAT_ARGB32, width, height, stride);
+	buf->data = (char *)pool->data + buf->offset;
+	buf->surface = cairo_image_surface_create_for_data(buf->data,
+			CAIRO_FORMAT_ARGB32, buf->width, buf->height, buf->width * 4);
+	cairo_surface_set_device_scale(buf->surface, buf->scale, buf->scale);
 	buf->cairo = cairo_create(buf->surface);
+}
 
-	wl_buffer_add_listener(buf->buffer, &buffer_listener, buf);
-	return buf;
+static bool grow_pool(struct wl_shm *shm, struct buffer_pool *pool,
+		size_t size) {
+	if (!pool->pool) {
+		int fd = create_pool_fd(size);
+		if (fd < 0) {
+			return false;
+		}
+
+		void *data = mmap(NULL, size, PROT_READ | PROT_WRITE, MAP_SHARED, fd, 0);
+		if (data == MAP_FAILED) {
+			close(fd);
+			return false;
+		}
+
+		pool->fd = fd;
+		pool->data = data;
+		pool->size = size;
+		pool->pool = wl_shm_create_pool(shm, fd, size);
+		return true;
+	}
+
+	if (ftruncate(pool->fd, size) < 0) {
+		return false;
+	}
+
+	void *data = mmap(NULL, size, PROT_READ | PROT_WRITE, MAP_SHARED,
+			pool->fd, 0);
+	if (data == MAP_FAILED) {
+		return false;
+	}
+
+	munmap(pool->data, pool->size);
+	pool->data = data;
+	pool->size = size;
+	wl_shm_pool_resize(pool->pool, size);
+
+	// the contents stay the same but the cairo surfaces
+	// still point into the old mapping
+	for (size_t i = 0; i < POOL_BUFFER_COUNT; ++i) {
+		if (pool->buffers[i].buffer) {
+			map_buffer(pool, &pool->buffers[i]);
+		}
+	}
+
+	return true;
 }
 
-void destroy_buffer(struct pool_buffer *buffer) {
+// Returns the lowest offset at which size bytes fit between the
+// regions of the buffers. May be beyond the end of the pool.
+static size_t find_gap(struct buffer_pool *pool, size_t size) {
+	size_t offset = 0;
+	bool moved = true;
+	while (moved) {
+		moved = false;
+		for (size_t i = 0; i < POOL_BUFFER_COUNT; ++i) {
+			struct pool_buffer *buf = &pool->buffers[i];
+			if (buf->size && offset < buf->offset + buf->size &&
+					buf->offset < offset + size) {
+				offset = buf->offset + buf->size;
+				moved = true;
+			}
+		}
+	}
+	return offset;
+}
+
+static void release_buffer(struct pool_buffer *buffer);
+
+// Makes sure the region of buf is at least size bytes large.
+// Free space between the regions is reused, the pool only grows
+// when the buffers in use don't leave enough of it.
+static bool alloc_region(struct wl_shm *shm, struct buffer_pool *pool,
+		struct pool_buffer *buf, size_t size) {
+	if (buf->size >= size) {
+		return true;
+	}
+
+	buf->offset = buf->size = 0;
+	size_t offset = find_gap(pool, size);
+	if (offset + size > pool->size) {
+		// drop the idle buffers instead of growing around them
+		for (size_t i = 0; i < POOL_BUFFER_COUNT; ++i) {
+			struct pool_buffer *other = &pool->buffers[i];
+			if (other != buf && !other->busy && other->size) {
+				release_buffer(other);
+				other->offset = other->size = 0;
+			}
+		}
+		offset = find_gap(pool, size);
+	}
+
+	if (offset + size > pool->size && !grow_pool(shm, pool, offset + size)) {
+		return false;
+	}
+
+	buf->offset = offset;
+	buf->size = size;
+	return true;
+}
+
+// Destroys the wl_buffer and cairo surface but keeps the region.
+static void release_buffer(struct pool_buffer *buffer) {
 	if (buffer->buffer) {
 		wl_buffer_destroy(buffer->buffer);
 	}
@@ -132,37 +242,94 @@ void destroy_buffer(struct pool_buffer *buffer) {
 	if (buffer->surface) {
 		cairo_surface_destroy(buffer->surface);
 	}
-	if (buffer->data) {
-		munmap(buffer->data, buffer->size);
-	}
+
+	size_t offset = buffer->offset;
+	size_t size = buffer->size;
 	memset(buffer, 0, sizeof(struct pool_buffer));
+	buffer->offset = offset;
+	buffer->size = size;
+}
+
+static struct pool_buffer *create_buffer(struct wl_shm *shm,
+		struct buffer_pool *pool, struct pool_buffer *buf,
+		int32_t width, int32_t height, double scale, uint32_t format) {
+	uint32_t stride = width * 4;
+	size_t size = stride * height;
+	if (!alloc_region(shm, pool, buf, size)) {
+		fprintf(stderr, "failed to allocate shm buffer\n");
+		return NULL;
+	}
+
+	buf->buffer = wl_shm_pool_create_buffer(pool->pool, buf->offset,
+			width, height, stride, format);
+	buf->width = width;
+	buf->height = height;
+	buf->scale = scale;
+	map_buffer(pool, buf);
+
+	wl_buffer_add_listener(buf->buffer, &buffer_listener, buf);
+	return buf;
+}
+
+void destroy_buffer_pool(struct buffer_pool *pool) {
+	for (size_t i = 0; i < POOL_BUFFER_COUNT; ++i) {
+		release_buffer(&pool->buffers[i]);
+	}
+	if (pool->pool) {
+		wl_shm_pool_destroy(pool->pool);
+		munmap(pool->data, pool->size);
+		close(pool->fd);
+	}
+	memset(pool, 0, sizeof(struct buffer_pool));
 }
 
 struct pool_buffer *get_next_buffer(struct wl_shm *shm,
-		struct pool_buffer pool[static 2], uint32_t width, uint32_t height) {
+		struct buffer_pool *pool, uint32_t width, uint32_t height,
+		double scale) {
 	struct pool_buffer *buffer = NULL;
 
-	for (size_t i = 0; i < 2; ++i) {
-		if (pool[i].busy) {
-			continue;
+	// prefer an idle buffer of the same size and scale, then an unused
+	// slot and only then replace the least recently used idle buffer
+	for (size_t i = 0; i < POOL_BUFFER_COUNT && !buffer; ++i) {
+		struct pool_buffer *buf = &pool->buffers[i];
+		if (buf->buffer && !buf->busy && buf->width == width &&
+				buf->height == height && buf->scale == scale) {
+			buffer = buf;
+		}
+	}
+
+	for (size_t i = 0; i < POOL_BUFFER_COUNT && !buffer; ++i) {
+		if (!pool->buffers[i].buffer) {
+			buffer = &pool->buffers[i];
+		}
+	}
+
+	if (!buffer) {
+		for (size_t i = 0; i < POOL_BUFFER_COUNT; ++i) {
+			struct pool_buffer *buf = &pool->buffers[i];
+			if (!buf->busy && (!buffer ||
+					buf->last_used < buffer->last_used)) {
+				buffer = buf;
+			}
 		}
-		buffer = &pool[i];
 	}
 
 	if (!buffer) {
 		return NULL;
 	}
 
-	if (buffer->width != width || buffer->height != height) {
-		destroy_buffer(buffer);
+	if (buffer->width != width || buffer->height != height ||
+			buffer->scale != scale) {
+		release_buffer(buffer);
 	}
 
 	if (!buffer->buffer) {
-		if (!create_buffer(shm, buffer, width, height,
+		if (!create_buffer(shm, pool, buffer, width, height, scale,
 					WL_SHM_FORMAT_ARGB8888)) {
 			return NULL;
 		}
 	}
 	buffer->busy = true;
+	buffer->last_used = ++pool->use_count;
 	return buffer;
 }
@@ -5,16 +5,39 @@
 #include <stdint.h>
 #include <wayland-client.h>
 
+// Two buffers per size for the dashboard and banners, at two scales,
+// so moving between outputs doesn't reallocate
+#define POOL_BUFFER_COUNT 8
+
 struct pool_buffer {
 	struct wl_buffer *buffer;
 	cairo_surface_t *surface;
 	cairo_t *cairo;
 	uint32_t width, height;
+	double scale; // device scale of the cairo surface
+	uint64_t last_used; // pool use counter when it was last returned
 	void *data;
-	size_t size;
+	size_t offset, size; // allocated region in the pool
 	bool busy;
+	uint64_t stamp; // dashboard contents, see ui_draw_dashboard. 0 if undefined
+};
+
+// A single shm file all buffers are sub-allocated from.
+// The file only grows, buffers are kept until their slot is needed
+// for another size. Freed regions are reused and idle buffers are
+// dropped before the file grows, so it stays close to the size of
+// the buffers in use. Zero-initialized means empty.
+struct buffer_pool {
+	struct wl_shm_pool *pool;
+	int fd;
+	void *data;
+	size_t size; // size of the file
+	uint64_t use_count;
+	struct pool_buffer buffers[POOL_BUFFER_COUNT];
 };
 
+// Returns an idle buffer with the given size (in pixels) and scale,
+// NULL if all are busy.
 struct pool_buffer* get_next_buffer(struct wl_shm* shm,
-	struct pool_buffer pool[static 2], uint32_t width, uint32_t height);
-void destroy_buffer(struct pool_buffer* buffer);
+	struct buffer_pool* pool, uint32_t width, uint32_t height, double scale);
+void destroy_buffer_pool(struct buffer_pool* pool);
@@ -7,6 +7,7 @@
 #include <assert.h>
 #include <time.h>
 #include <errno.h>
+#include <math.h>
 
 #include <unistd.h>
 #include <linux/input.h>
@@ -15,6 +16,7 @@
 #include <xcb/xcb.h>
 #include <xcb/xcb_ewmh.h>
 #include <xcb/xcb_icccm.h>
+#include <xcb/randr.h>
 
 #include <cairo/cairo.h>
 #include <cairo/cairo-xcb.h>
@@ -25,6 +27,13 @@
 #include "ui.h"
 
 #define GRAB_KEYBOARD 0
+#define MAX_OUTPUTS 16u
+
+// Output geometry, in root window coordinates
+struct output {
+	int x, y;
+	unsigned width, height;
+};
 
 struct display_x11 {
 	struct display display;
@@ -49,9 +58,34 @@ struct display_x11 {
 		xcb_atom_t wm_delete_window;
 	} atoms;
 
-	cairo_surface_t* surface;
+	// Queried via randr once and on screen changes, so placing windows
+	// doesn't need a roundtrip. outputs[0] is the primary output.
+	struct output outputs[MAX_OUTPUTS];
+	unsigned output_count;
+	int randr_event; // first randr event, -1 if randr isn't available
+
+	xcb_visualtype_t* visualtype;
+	uint8_t depth;
+
+	// Back buffer. Frames are drawn into it and the changed regions
+	// are copied to the window. It is kept across frames (and hide/show)
+	// and only recreated when the window gets larger than it.
+	xcb_pixmap_t pixmap;
+	xcb_gcontext_t gc;
+	unsigned buffer_width, buffer_height;
+	cairo_surface_t* surface; // for pixmap
 	cairo_t* cr;
+	uint64_t stamp; // dashboard contents of the buffer, see ui_draw_dashboard
 
+	// Redraws are merged and done once per dispatch, after all
+	// events were processed. exposed is the bounding box of the regions
+	// the server lost since then (width 0 if none).
+	bool dirty;
+	struct ui_rect exposed;
+
+	// X has no per-output scale. Window and buffer sizes are in pixels,
+	// the ui draws in logical coordinates scaled by $DUI_SCALE.
+	double scale;
 	unsigned width, height;
 	enum banner banner; // whether a banner is active.
 	bool dashboard; // dashboard currently mapped
@@ -71,6 +105,98 @@ struct display_x11 {
 		free(gerr); \
 	}}
 
+static void query_outputs(struct display_x11* dpy) {
+	dpy->output_count = 0u;
+	if(dpy->randr_event >= 0) {
+		xcb_randr_get_monitors_cookie_t cookie = xcb_randr_get_monitors(
+			dpy->connection, dpy->screen->root, true);
+		xcb_randr_get_monitors_reply_t* reply = xcb_randr_get_monitors_reply(
+			dpy->connection, cookie, NULL);
+		if(reply) {
+			xcb_randr_monitor_info_iterator_t it =
+				xcb_randr_get_monitors_monitors_iterator(reply);
+			for(; it.rem && dpy->output_count < MAX_OUTPUTS;
+					xcb_randr_monitor_info_next(&it)) {
+				xcb_randr_monitor_info_t* info = it.data;
+				struct output output = {info->x, info->y,
+					info->width, info->height};
+				struct output* dst = &dpy->outputs[dpy->output_count++];
+				if(info->primary) {
+					*dst = dpy->outputs[0];
+					dst = &dpy->outputs[0];
+				}
+				*dst = output;
+			}
+			free(reply);
+		}
+	}
+
+	// without randr (or outputs): the whole screen
+	if(!dpy->output_count) {
+		dpy->outputs[0] = (struct output) {0, 0,
+			dpy->screen->width_in_pixels, dpy->screen->height_in_pixels};
+		dpy->output_count = 1u;
+	}
+}
+
+// Returns the output under the pointer, the primary one if it
+// can't be determined. Needs a roundtrip if there are multiple outputs.
+static const struct output* pointer_output(struct display_x11* dpy) {
+	if(dpy->output_count < 2) {
+		return &dpy->outputs[0];
+	}
+
+	const struct output* ret = &dpy->outputs[0];
+	xcb_query_pointer_cookie_t cookie = xcb_query_pointer(dpy->connection,
+		dpy->screen->root);
+	xcb_query_pointer_reply_t* reply = xcb_query_pointer_reply(
+		dpy->connection, cookie, NULL);
+	if(reply) {
+		for(unsigned i = 0u; i < dpy->output_count; ++i) {
+			const struct output* o = &dpy->outputs[i];
+			if(reply->root_x >= o->x && reply->root_x < o->x + (int) o->width &&
+					reply->root_y >= o->y && reply->root_y < o->y + (int) o->height) {
+				ret = o;
+				break;
+			}
+		}
+		free(reply);
+	}
+
+	return ret;
+}
+
+static void resize_buffer(struct display_x11* dpy, unsigned width,
+		unsigned height) {
+	dpy->width = width;
+	dpy->height = height;
+	if(dpy->pixmap && width <= dpy->buffer_width &&
+			height <= dpy->buffer_height) {
+		return;
+	}
+
+	if(dpy->cr) cairo_destroy(dpy->cr);
+	if(dpy->surface) cairo_surface_destroy(dpy->surface);
+	if(dpy->pixmap) xcb_free_pixmap(dpy->connection, dpy->pixmap);
+
+	// grow only, banner and dashboard can share the buffer
+	dpy->buffer_width = width > dpy->buffer_width ? width : dpy->buffer_width;
+	dpy->buffer_height = height > dpy->buffer_height ? height : dpy->buffer_height;
+	dpy->pixmap = xcb_generate_id(dpy->connection);
+	xcb_create_pixmap(dpy->connection, dpy->depth, dpy->pixmap, dpy->window,
+		dpy->buffer_width, dpy->buffer_height);
+	dpy->surface = cairo_xcb_surface_create(dpy->connection, dpy->pixmap,
+		dpy->visualtype, dpy->buffer_width, dpy->buffer_height);
+	cairo_surface_set_device_scale(dpy->surface, dpy->scale, dpy->scale);
+	dpy->cr = cairo_create(dpy->surface);
+	dpy->stamp = 0u;
+}
+
+// Logical size to pixels.
+static unsigned scaled(const struct display_x11* dpy, unsigned size) {
+	return round(dpy->scale * size);
+}
+
 static void configure_window(struct display_x11* dpy, int x, int y,
 		unsigned width, unsigned height, bool focus) {
 	if(dpy->override_redirect) {
@@ -107,28 +233,65 @@ static void configure_window(struct display_x11* dpy, int x, int y,
 	// NOTE: not sure whether it could be problematic to call this here
 	// already instead of waiting for the corresponding configure
 	// event
-	dpy->width = width;
-	dpy->height = height;
-	cairo_xcb_surface_set_size(dpy->surface, dpy->width, dpy->height);
+	resize_buffer(dpy, width, height);
+}
+
+// r is in pixels.
+static void copy_rect(struct display_x11* dpy, struct ui_rect r) {
+	xcb_copy_area(dpy->connection, dpy->pixmap, dpy->window, dpy->gc,
+		r.x, r.y, r.x, r.y, r.width, r.height);
 }
 
+// Updates the back buffer and copies the changed and exposed regions
+// to the window.
 static void draw(struct display_x11* dpy) {
+	struct ui_rect exposed = dpy->exposed;
+	dpy->dirty = false;
+	dpy->exposed.width = 0;
 	if(!dpy->dashboard && dpy->banner == banner_none) {
 		return;
 	}
 
-	// this whole group thing is basically copying
-	// the underlying cairo x11 surface doesn't use double buffering
-	// so we need it to avoid flickering
-	cairo_push_group(dpy->cr);
-	ui_draw(dpy->ui, dpy->cr, dpy->width, dpy->height, dpy->banner);
-
-	cairo_pop_group_to_source(dpy->cr);
-	cairo_set_operator(dpy->cr, CAIRO_OPERATOR_SOURCE);
-	cairo_paint(dpy->cr);
-	cairo_set_operator(dpy->cr, CAIRO_OPERATOR_OVER);
+	struct ui_damage damage;
+	unsigned width = dpy->width / dpy->scale;
+	unsigned height = dpy->height / dpy->scale;
+	if(dpy->dashboard) {
+		dpy->stamp = ui_draw_dashboard(dpy->ui, dpy->cr, width, height,
+			dpy->stamp, &damage);
+	} else {
+		ui_draw(dpy->ui, dpy->cr, width, height, dpy->banner);
+		damage.count = 1u;
+		damage.rects[0] = (struct ui_rect) {0, 0, width, height};
+		dpy->stamp = 0u;
+	}
 
 	cairo_surface_flush(dpy->surface);
+	for(unsigned i = 0u; i < damage.count; ++i) {
+		copy_rect(dpy, ui_rect_scale(damage.rects[i], dpy->scale));
+	}
+
+	if(exposed.width) {
+		copy_rect(dpy, exposed);
+	}
+}
+
+static void schedule(struct display_x11* dpy) {
+	dpy->dirty = true;
+}
+
+static void expose(struct display_x11* dpy, struct ui_rect r) {
+	struct ui_rect* e = &dpy->exposed;
+	if(!e->width) {
+		*e = r;
+		return;
+	}
+
+	int x2 = e->x + e->width > r.x + r.width ? e->x + e->width : r.x + r.width;
+	int y2 = e->y + e->height > r.y + r.height ? e->y + e->height : r.y + r.height;
+	e->x = e->x < r.x ? e->x : r.x;
+	e->y = e->y < r.y ? e->y : r.y;
+	e->width = x2 - e->x;
+	e->height = y2 - e->y;
 }
 
 static void display_map_dashboard(struct display_x11* ctx) {
@@ -143,14 +306,14 @@ static void display_map_dashboard(struct display_x11* ctx) {
 		xcb_unmap_window(ctx->connection, ctx->window);
 	}
 
-	// TODO: don't hardcode center of screen to 1920x1080 res
-	// instead use xcb_get_geometry (once, during initialization)
+	// center on the output the user is looking at
+	const struct output* output = pointer_output(ctx);
+	unsigned width = scaled(ctx, start_width);
+	unsigned height = scaled(ctx, start_height);
 	configure_window(ctx,
-		(1920 - start_width) / 2,
-		(1080 - start_height) / 2,
-		start_width, start_height, true);
-	ctx->width = start_width;
-	ctx->height = start_height;
+		output->x + ((int) output->width - (int) width) / 2,
+		output->y + ((int) output->height - (int) height) / 2,
+		width, height, true);
 	ctx->dashboard = true;
 
 	// initial drawing to avoid undefined contents when first mapped
@@ -227,49 +390,40 @@ void display_unmap_dashboard(struct display_x11* ctx) {
 	xcb_flush(ctx->connection);
 }
 
-static void send_expose_event(struct display_x11* ctx) {
-	// NOTE: not exactly sure if xcb is threadsafe and we can use
-	// this at any time tbh... there is no XInitThreads for xcb,
-	// iirc it is always threadsafe but that should be investigated
-	xcb_expose_event_t event = {0};
-	event.window = ctx->window;
-	event.response_type = XCB_EXPOSE;
-	event.x = 0;
-	event.y = 0;
-	event.width = ctx->width;
-	event.height = ctx->height;
-	event.count = 1;
-
-	xcb_send_event(ctx->connection, 0, ctx->window, 0, (const char*) &event);
-	xcb_flush(ctx->connection);
-}
-
 void process(struct display_x11* ctx, xcb_generic_event_t* gev) {
+	if(ctx->randr_event >= 0 && (gev->response_type & 0x7f) ==
+			ctx->randr_event + XCB_RANDR_SCREEN_CHANGE_NOTIFY) {
+		query_outputs(ctx);
+		return;
+	}
+
 	switch(gev->response_type & 0x7f) {
 		// NOTE: could re-enable that but we currently draw the window
 		// initially when mapping it to prevent any delay
 		// case XCB_MAP_NOTIFY:
-		case XCB_EXPOSE:
-			draw(ctx);
+		case XCB_EXPOSE: {
+			// the server lost the window contents, copied from the buffer
+			xcb_expose_event_t* ev = (xcb_expose_event_t*) gev;
+			expose(ctx, (struct ui_rect) {ev->x, ev->y, ev->width, ev->height});
+			schedule(ctx);
 			break;
-		case XCB_CONFIGURE_NOTIFY: {
+		} case XCB_CONFIGURE_NOTIFY: {
 			xcb_configure_notify_event_t* ev = (xcb_configure_notify_event_t*) gev;
 			if(ev->width != ctx->width || ev->height != ctx->height) {
-				cairo_xcb_surface_set_size(ctx->surface, ev->width, ev->height);
-				ctx->width = ev->width;
-				ctx->height = ev->height;
+				resize_buffer(ctx, ev->width, ev->height);
 				printf("resize: %d %d\n", ctx->width, ctx->height);
 			}
 			break;
 		} case XCB_KEY_PRESS: {
 			xcb_key_press_event_t* ev = (xcb_key_press_event_t*) gev;
+			trace_instant("key");
 			unsigned keycode = ev->detail - 8;
 			if(ctx->dashboard && ui_key(ctx->ui, keycode)) {
 				display_unmap_dashboard(ctx);
 			} else {
 				// TODO: don't always do this. ui should be able to trigger
 				// it i guess
-				send_expose_event(ctx);
+				schedule(ctx);
 			}
 			break;
 		} case XCB_CLIENT_MESSAGE: {
@@ -294,12 +448,14 @@ void process(struct display_x11* ctx, xcb_generic_event_t* gev) {
 
 
 static void banner_timer_cb(struct pml_timer* timer) {
+	uint64_t start = stats_now();
 	struct display_x11* ctx = (struct display_x11*) pml_timer_get_data(timer);
 
 	// hide banner
 	ctx->banner = banner_none;
 	xcb_unmap_window(ctx->connection, ctx->window);
 	xcb_flush(ctx->connection);
+	stats_record(stats_display_timer, start);
 }
 
 static void toggle_dashboard(struct display* base) {
@@ -319,12 +475,14 @@ static void show_banner(struct display* base, enum banner banner) {
 	}
 
 	if(dpy->banner == banner_none) {
+		// banners go to the primary output, without roundtrip
+		const struct output* output = &dpy->outputs[0];
+		unsigned width = scaled(dpy, banner_width);
+		unsigned height = scaled(dpy, banner_height);
 		configure_window(dpy,
-			1920 - banner_width - banner_margin_x,
-			1080 - banner_height - banner_margin_y,
-			banner_width, banner_height, false);
-		dpy->width = banner_width;
-		dpy->height = banner_height;
+			output->x + (int) (output->width - width - scaled(dpy, banner_margin_x)),
+			output->y + (int) (output->height - height - scaled(dpy, banner_margin_y)),
+			width, height, false);
 		dpy->banner = banner;
 
 		// initial draw to avoid undefined contents when mapped
@@ -334,7 +492,7 @@ static void show_banner(struct display* base, enum banner banner) {
 		xcb_ewmh_set_wm_name(&dpy->ewmh, dpy->window, strlen(title), title);
 		xcb_map_window(dpy->connection, dpy->window);
 	} else {
-		send_expose_event(dpy);
+		schedule(dpy);
 	}
 
 	dpy->banner = banner;
@@ -353,6 +511,12 @@ static void destroy(struct display* base) {
 	if(dpy->cr) cairo_destroy(dpy->cr);
 	if(dpy->surface) cairo_surface_destroy(dpy->surface);
 	if(dpy->connection) {
+		if(dpy->pixmap) {
+			xcb_free_pixmap(dpy->connection, dpy->pixmap);
+		}
+		if(dpy->gc) {
+			xcb_free_gc(dpy->connection, dpy->gc);
+		}
 		if(dpy->window) {
 			xcb_destroy_window(dpy->connection, dpy->window);
 		}
@@ -364,7 +528,7 @@ static void destroy(struct display* base) {
 static void redraw(struct display* base, enum banner banner) {
 	struct display_x11* dpy = (struct display_x11*) base;
 	if(dpy->dashboard || (dpy->banner != banner_none && dpy->banner == banner)) {
-		send_expose_event(dpy);
+		schedule(dpy);
 	}
 }
 
@@ -391,7 +555,7 @@ static unsigned es_query(struct pml_custom* c, struct pollfd* fds,
 		unsigned n_fds, int* timeout) {
 	struct display_x11* dpy = (struct display_x11*) pml_custom_get_data(c);
 
-	*timeout = dpy->pending ? 0 : -1;
+	*timeout = (dpy->pending || dpy->dirty) ? 0 : -1;
 	if(n_fds > 0) {
 		fds[0].fd = xcb_get_file_descriptor(dpy->connection),
 		fds[0].events = POLLIN;
@@ -400,11 +564,7 @@ static unsigned es_query(struct pml_custom* c, struct pollfd* fds,
 	return 1;
 }
 
-static void es_dispatch(struct pml_custom* c, struct pollfd* fds, unsigned n_fds) {
-	(void) fds;
-	(void) n_fds;
-	struct display_x11* dpy = (struct display_x11*) pml_custom_get_data(c);
-
+static void dispatch(struct display_x11* dpy) {
 	// check for error
 	int err = xcb_connection_has_error(dpy->connection);
 	if(err != 0) {
@@ -426,9 +586,25 @@ static void es_dispatch(struct pml_custom* c, struct pollfd* fds, unsigned n_fds
 		free(gev);
 	}
 
+	// one frame for all redraw requests and exposes since the last one
+	if(dpy->dirty) {
+		draw(dpy);
+	}
+
 	xcb_flush(dpy->connection);
 }
 
+static void es_dispatch(struct pml_custom* c, struct pollfd* fds, unsigned n_fds) {
+	(void) fds;
+	(void) n_fds;
+
+	uint64_t start = stats_now();
+	uint64_t trace = trace_begin();
+	dispatch((struct display_x11*) pml_custom_get_data(c));
+	trace_end("x11 es_dispatch", trace);
+	stats_record(stats_display, start);
+}
+
 static const struct pml_custom_impl custom_impl = {
 	.prepare = es_prepare,
 	.query = es_query,
@@ -441,6 +617,19 @@ struct display* display_create_x11(struct ui* ui) {
 	ctx->ui = ui;
 	ctx->override_redirect = true;
 
+	// no way to query a scale from X, the resources (Xft.dpi) are
+	// not reliably set either
+	ctx->scale = 1.0;
+	const char* scale = getenv("DUI_SCALE");
+	if(scale) {
+		double value = strtod(scale, NULL);
+		if(value > 0.0 && value <= 8.0) {
+			ctx->scale = value;
+		} else {
+			printf("x11: invalid DUI_SCALE '%s'\n", scale);
+		}
+	}
+
 	// setup xcb connection
 	ctx->connection = xcb_connect(NULL, NULL);
 	int err;
@@ -488,6 +677,30 @@ struct display* display_create_x11(struct ui* ui) {
 
 	xcb_ewmh_init_atoms_replies(&ctx->ewmh, ewmh_cookie, NULL);
 
+	// outputs, monitor list requires randr 1.5
+	ctx->randr_event = -1;
+	const xcb_query_extension_reply_t* randr = xcb_get_extension_data(
+		ctx->connection, &xcb_randr_id);
+	if(randr && randr->present) {
+		xcb_randr_query_version_cookie_t cookie = xcb_randr_query_version(
+			ctx->connection, 1, 5);
+		xcb_randr_query_version_reply_t* version =
+			xcb_randr_query_version_reply(ctx->connection, cookie, NULL);
+		if(version && (version->major_version > 1 ||
+				version->minor_version >= 5)) {
+			ctx->randr_event = randr->first_event;
+			xcb_randr_select_input(ctx->connection, ctx->screen->root,
+				XCB_RANDR_NOTIFY_MASK_SCREEN_CHANGE);
+		}
+		free(version);
+	}
+
+	if(ctx->randr_event < 0) {
+		printf("x11: randr 1.5 not available, using the whole screen\n");
+	}
+
+	query_outputs(ctx);
+
 	// init visual
 	// we want a 32-bit visual
 	xcb_depth_iterator_t dit = xcb_screen_allowed_depths_iterator(ctx->screen);
@@ -531,8 +744,8 @@ struct display* display_create_x11(struct ui* ui) {
 	// 	visualtype->bits_per_rgb_value);
 
 	// setup xcb window
-	ctx->width = start_width;
-	ctx->height = start_height;
+	ctx->width = scaled(ctx, start_width);
+	ctx->height = scaled(ctx, start_height);
 
 	uint32_t mask;
 
@@ -589,10 +802,15 @@ struct display* display_create_x11(struct ui* ui) {
 	pid_t pid = getpid();
 	xcb_ewmh_set_wm_pid(&ctx->ewmh, ctx->window, pid);
 
-	// setup cairo
-	ctx->surface = cairo_xcb_surface_create(ctx->connection,
-		ctx->window, visualtype, ctx->width, ctx->height);
-	ctx->cr = cairo_create(ctx->surface);
+	// setup back buffer. No graphics exposures, the buffer is never
+	// obscured, so copies from it always succeed
+	ctx->visualtype = visualtype;
+	ctx->depth = vdepth;
+	uint32_t gc_values[] = {0};
+	ctx->gc = xcb_generate_id(ctx->connection);
+	xcb_create_gc(ctx->connection, ctx->gc, ctx->window,
+		XCB_GC_GRAPHICS_EXPOSURES, gc_values);
+	resize_buffer(ctx, ctx->width, ctx->height);
 
 	// init timer for banner timeout
 	ctx->timer = pml_timer_new(dui_pml(), NULL, banner_timer_cb);